@@ -0,0 +1,167 @@
+// Microbenchmarks of the job system: spawn and steal overhead per job
+// and ParallelFor / TaskGraph scaling from 1 to 64 threads. Thread counts
+// above the hardware thread count are oversubscribed and marked as such.
+//
+// Build with -DENGINE_BUILD_BENCHMARKS=ON and run JobSystemBenchmark.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include "jobs/job_system.h"
+#include "jobs/task_graph.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double SecondsSince(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Jobs spawned before waiting for them. Fits the spawning thread's
+// deque, so the numbers measure the deques and not the injection queue
+// that takes the overflow.
+constexpr uint32_t kBatch = 4096;
+
+// Stand-in for per-item work such as transforming a vertex
+uint32_t Work(uint32_t seed, uint32_t rounds) {
+    uint32_t x = seed | 1u;
+    for (uint32_t i = 0; i < rounds; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+    }
+    return x;
+}
+
+// Spawn and run empty jobs on one thread: pure scheduling overhead.
+void SpawnOverhead(uint32_t jobs) {
+    engine_jobs::JobSystem system(1);
+    engine_jobs::JobCounter counter;
+    double spawn = 0.0;
+    const auto start = Clock::now();
+    for (uint32_t done = 0; done < jobs; done += kBatch) {
+        const uint32_t batch = std::min(kBatch, jobs - done);
+        const auto batch_start = Clock::now();
+        for (uint32_t i = 0; i < batch; i++) {
+            system.Spawn([] {}, &counter);
+        }
+        spawn += SecondsSince(batch_start);
+        system.Wait(counter);
+    }
+    const double total = SecondsSince(start);
+    std::printf("spawn       %8.1f ns/job  spawn+run %8.1f ns/job\n",
+        spawn * 1e9 / jobs,
+        total * 1e9 / jobs);
+}
+
+// The main thread only spawns and never helps, so every job is stolen
+// by the other workers. Jobs go out in deque-sized batches.
+void StealOverhead(uint32_t threads, uint32_t jobs) {
+    engine_jobs::JobSystem system(threads);
+    engine_jobs::JobCounter counter;
+    const auto start = Clock::now();
+    for (uint32_t done = 0; done < jobs; done += kBatch) {
+        const uint32_t batch = std::min(kBatch, jobs - done);
+        for (uint32_t i = 0; i < batch; i++) {
+            system.Spawn([] {}, &counter);
+        }
+        // Spinning on Done() is safe: the decrement to zero is the
+        // finishing job's last access, so the counter may go out of
+        // scope right after
+        while (!counter.Done()) {
+            std::this_thread::yield();
+        }
+    }
+    const double total = SecondsSince(start);
+    const engine_jobs::JobSystemStats stats = system.stats();
+    std::printf("steal  %2u   %8.1f ns/job  steals %llu injected %llu\n",
+        threads,
+        total * 1e9 / jobs,
+        static_cast<unsigned long long>(stats.steals),
+        static_cast<unsigned long long>(stats.injected));
+}
+
+double ParallelForSeconds(uint32_t threads,
+    uint32_t items,
+    uint32_t grain,
+    uint32_t rounds) {
+    engine_jobs::JobSystem system(threads);
+    std::vector<uint32_t> out(items);
+    double best = 1e30;
+    for (int repeat = 0; repeat < 5; repeat++) {
+        const auto start = Clock::now();
+        auto body = [&](uint32_t begin, uint32_t end) {
+            for (uint32_t i = begin; i < end; i++) {
+                out[i] = Work(i, rounds);
+            }
+        };
+        system.ParallelFor(items, grain, body);
+        best = std::min(best, SecondsSince(start));
+    }
+    return best;
+}
+
+// Wide fan-out / fan-in graph, like per-mesh processing feeding one
+// upload step.
+double TaskGraphSeconds(uint32_t threads,
+    uint32_t width,
+    uint32_t rounds) {
+    engine_jobs::JobSystem system(threads);
+    engine_jobs::TaskGraph graph;
+    std::vector<uint32_t> out(width);
+    const auto root = graph.Add([] {});
+    const auto sink = graph.Add([] {});
+    for (uint32_t i = 0; i < width; i++) {
+        const auto node =
+            graph.Add([&out, i, rounds] { out[i] = Work(i, rounds); });
+        graph.Precede(root, node);
+        graph.Precede(node, sink);
+    }
+    double best = 1e30;
+    for (int repeat = 0; repeat < 5; repeat++) {
+        const auto start = Clock::now();
+        graph.RunAndWait(system);
+        best = std::min(best, SecondsSince(start));
+    }
+    return best;
+}
+
+void Scaling() {
+    const uint32_t hardware = std::thread::hardware_concurrency();
+    std::printf("\nscaling (hardware threads: %u)\n", hardware);
+    std::printf("threads  parallel_for          task_graph\n");
+    double base_for = 0.0;
+    double base_graph = 0.0;
+    for (uint32_t threads = 1; threads <= 64; threads *= 2) {
+        const double for_seconds =
+            ParallelForSeconds(threads, 1u << 20, 1024, 64);
+        const double graph_seconds = TaskGraphSeconds(threads, 4096, 4096);
+        if (threads == 1) {
+            base_for = for_seconds;
+            base_graph = graph_seconds;
+        }
+        std::printf("%7u  %7.2f ms x%5.2f   %7.2f ms x%5.2f%s\n",
+            threads,
+            for_seconds * 1e3,
+            base_for / for_seconds,
+            graph_seconds * 1e3,
+            base_graph / graph_seconds,
+            threads > hardware ? "  (oversubscribed)" : "");
+    }
+}
+
+}  // namespace
+
+int main() {
+    constexpr uint32_t kJobs = 1 << 20;
+    SpawnOverhead(kJobs);
+    for (uint32_t threads : {2u, 4u, 8u}) {
+        StealOverhead(threads, kJobs);
+    }
+    Scaling();
+}
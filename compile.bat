@@ -6,7 +6,7 @@ set "SHADER_OUT_DIR=%~2"
 echo Compiling all .slang shaders in %SHADER_DIR%...
 
 if not exist "%SHADER_OUT_DIR%" mkdir "%SHADER_OUT_DIR%"
-for %%e in (.rgen, .rmiss, .rchit) do (
+for %%e in (.rgen, .rmiss, .rchit, .comp) do (
     for %%f in ("%SHADER_DIR%\*%%e") do (
         set "INPUT_FILE=%%f"
         set "OUTPUT_NAME=%%~nf%%e.spv"
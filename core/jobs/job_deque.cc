@@ -0,0 +1,69 @@
+#include "job_deque.h"
+
+#include <bit>
+#include <stdexcept>
+
+namespace engine_jobs {
+
+JobDeque::JobDeque(uint32_t capacity) {
+    if (!std::has_single_bit(capacity)) {
+        throw std::invalid_argument(
+            "job deque capacity must be a power of two!");
+    }
+    mask_ = capacity - 1;
+    slots_ = std::make_unique<std::atomic<Job*>[]>(capacity);
+}
+
+bool JobDeque::Push(Job* job) {
+    const int64_t bottom = bottom_.load(std::memory_order_relaxed);
+    const int64_t top = top_.load(std::memory_order_acquire);
+    if (bottom - top > mask_) {
+        return false;
+    }
+    slots_[bottom & mask_].store(job, std::memory_order_release);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom_.store(bottom + 1, std::memory_order_relaxed);
+    return true;
+}
+
+Job* JobDeque::Pop() {
+    const int64_t bottom = bottom_.load(std::memory_order_relaxed) - 1;
+    bottom_.store(bottom, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t top = top_.load(std::memory_order_relaxed);
+    if (top > bottom) {
+        bottom_.store(bottom + 1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    Job* job = slots_[bottom & mask_].load(std::memory_order_relaxed);
+    if (top == bottom) {
+        // Last job, race the thieves for it
+        if (!top_.compare_exchange_strong(top,
+                top + 1,
+                std::memory_order_seq_cst,
+                std::memory_order_relaxed)) {
+            job = nullptr;
+        }
+        bottom_.store(bottom + 1, std::memory_order_relaxed);
+    }
+    return job;
+}
+
+Job* JobDeque::Steal() {
+    int64_t top = top_.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const int64_t bottom = bottom_.load(std::memory_order_acquire);
+    if (top >= bottom) {
+        return nullptr;
+    }
+    Job* job = slots_[top & mask_].load(std::memory_order_acquire);
+    if (!top_.compare_exchange_strong(top,
+            top + 1,
+            std::memory_order_seq_cst,
+            std::memory_order_relaxed)) {
+        return nullptr;
+    }
+    return job;
+}
+
+}  // namespace engine_jobs
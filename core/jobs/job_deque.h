@@ -0,0 +1,38 @@
+
+#ifndef ENGINE_JOBS_JOB_DEQUE_H_
+#define ENGINE_JOBS_JOB_DEQUE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+namespace engine_jobs {
+
+struct Job;
+
+// Fixed-capacity Chase-Lev deque. The owning worker pushes and pops at
+// the bottom without contention; other threads steal from the top. A
+// full deque rejects the push and the caller falls back to the shared
+// injection queue of the JobSystem.
+struct JobDeque {
+   public:
+    explicit JobDeque(uint32_t capacity = 4096);
+    // No copy
+    JobDeque(const JobDeque&) = delete;
+    JobDeque& operator=(const JobDeque&) = delete;
+
+    // Owner thread only.
+    bool Push(Job* job);
+    Job* Pop();
+    // Any thread. Returns nullptr when empty or when another thief won.
+    Job* Steal();
+
+   private:
+    alignas(64) std::atomic<int64_t> top_{0};
+    alignas(64) std::atomic<int64_t> bottom_{0};
+    int64_t mask_;
+    std::unique_ptr<std::atomic<Job*>[]> slots_;
+};
+}  // namespace engine_jobs
+
+#endif
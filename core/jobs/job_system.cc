@@ -0,0 +1,356 @@
+#include "job_system.h"
+
+#include <algorithm>
+
+namespace engine_jobs {
+
+namespace {
+// Worker the current thread belongs to. Pool threads register when they
+// start, the constructing thread for the lifetime of the JobSystem.
+struct WorkerBinding {
+    const JobSystem* system = nullptr;
+    void* worker = nullptr;
+};
+thread_local WorkerBinding tls_binding;
+// Steal order of threads outside the pool
+thread_local uint32_t tls_random_state = 0x9e3779b9u;
+
+uint32_t NextRandom(uint32_t& state) {
+    // xorshift32
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+}  // namespace
+
+void JobCounter::Add() {
+    if (count_.fetch_add(1, std::memory_order_relaxed) == 0) {
+        // Reused after reaching zero
+        std::lock_guard lock(mutex_);
+        closing_ = false;
+    }
+}
+
+bool JobCounter::Defer(Job* job) {
+    std::lock_guard lock(mutex_);
+    if (closing_ || count_.load(std::memory_order_acquire) == 0) {
+        return false;
+    }
+    continuations_.push_back(job);
+    return true;
+}
+
+std::vector<Job*> JobCounter::Finish(std::exception_ptr error) {
+    // Fast path while other jobs are still in flight
+    uint32_t count = count_.load(std::memory_order_relaxed);
+    while (!error && count > 1) {
+        if (count_.compare_exchange_weak(count,
+                count - 1,
+                std::memory_order_acq_rel,
+                std::memory_order_relaxed)) {
+            return {};
+        }
+    }
+    // Possibly the last one. The error is stored under the lock, which
+    // orders it against Defer. Whether this job is the last one is
+    // decided by the same compare-exchange that decrements, so a fast
+    // path finisher cannot slip in between. A job that is not the last
+    // leaves the count at one or more, which keeps the counter alive
+    // until the lock is released. The last job's decrement comes after
+    // the lock and is its final access: a waiter may destroy the counter
+    // as soon as it sees zero.
+    std::vector<Job*> ready;
+    {
+        std::lock_guard lock(mutex_);
+        if (error && !error_) {
+            error_ = error;
+        }
+        count = count_.load(std::memory_order_acquire);
+        while (count > 1) {
+            if (count_.compare_exchange_weak(count,
+                    count - 1,
+                    std::memory_order_acq_rel,
+                    std::memory_order_acquire)) {
+                return {};
+            }
+        }
+        ready.swap(continuations_);
+        closing_ = true;
+    }
+    count_.fetch_sub(1, std::memory_order_acq_rel);
+    return ready;
+}
+
+std::exception_ptr JobCounter::TakeError() {
+    std::lock_guard lock(mutex_);
+    return std::exchange(error_, nullptr);
+}
+
+void JobTask::FinalAwaiter::await_suspend(Handle handle) noexcept {
+    promise_type& promise = handle.promise();
+    JobSystem* system = promise.system;
+    JobCounter* signal = promise.signal;
+    std::exception_ptr error = promise.error;
+    handle.destroy();
+    system->Complete(signal, error);
+}
+
+void JobSystem::CounterAwaiter::await_suspend(
+    std::coroutine_handle<> handle) {
+    system.Spawn([handle] { handle.resume(); }, nullptr, &counter);
+}
+
+void JobSystem::CounterAwaiter::await_resume() {
+    if (std::exception_ptr error = counter.TakeError()) {
+        std::rethrow_exception(error);
+    }
+}
+
+JobSystem::JobSystem(uint32_t thread_count) {
+    if (thread_count == 0) {
+        thread_count = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    for (uint32_t i = 0; i < thread_count; i++) {
+        auto worker = std::make_unique<Worker>();
+        worker->index = i;
+        worker->random_state = 0x9e3779b9u * (i + 1);
+        workers_.push_back(std::move(worker));
+    }
+    tls_binding = {this, workers_[0].get()};
+    for (uint32_t i = 1; i < thread_count; i++) {
+        workers_[i]->thread = std::thread(&JobSystem::WorkerLoop, this, i);
+    }
+}
+
+JobSystem::~JobSystem() {
+    stopping_.store(true, std::memory_order_seq_cst);
+    wake_epoch_.fetch_add(1, std::memory_order_seq_cst);
+    wake_epoch_.notify_all();
+    for (const auto& worker : workers_) {
+        if (worker->thread.joinable()) {
+            worker->thread.join();
+        }
+    }
+    // Jobs nobody waited for are dropped without running
+    for (const auto& worker : workers_) {
+        while (Job* job = worker->deque.Steal()) {
+            delete job;
+        }
+    }
+    for (Job* job : injected_jobs_) {
+        delete job;
+    }
+    if (tls_binding.system == this) {
+        tls_binding = {};
+    }
+}
+
+JobSystem::Worker* JobSystem::CurrentWorker() const {
+    if (tls_binding.system != this) {
+        return nullptr;
+    }
+    return static_cast<Worker*>(tls_binding.worker);
+}
+
+uint32_t JobSystem::CurrentThreadIndex() const {
+    Worker* worker = CurrentWorker();
+    return worker ? worker->index : kNotAWorker;
+}
+
+void JobSystem::Spawn(std::function<void()> function,
+    JobCounter* signal,
+    JobCounter* dependency) {
+    Job* job = new Job{std::move(function), signal};
+    if (signal) {
+        signal->Add();
+    }
+    if (dependency && dependency->Defer(job)) {
+        return;
+    }
+    Push(job);
+}
+
+void JobSystem::Spawn(JobTask task, JobCounter* signal) {
+    JobTask::Handle handle = std::exchange(task.handle, nullptr);
+    handle.promise().system = this;
+    handle.promise().signal = signal;
+    if (signal) {
+        signal->Add();
+    }
+    Push(new Job{[handle] { handle.resume(); }, nullptr});
+}
+
+void JobSystem::Wait(JobCounter& counter) {
+    Worker* worker = CurrentWorker();
+    while (!counter.Done()) {
+        if (Job* job = FindJob(worker)) {
+            Execute(job, worker);
+        } else {
+            std::this_thread::yield();
+        }
+    }
+    if (std::exception_ptr error = counter.TakeError()) {
+        std::rethrow_exception(error);
+    }
+}
+
+void JobSystem::ParallelFor(uint32_t count,
+    uint32_t grain,
+    const std::function<void(uint32_t, uint32_t)>& body) {
+    if (count == 0) {
+        return;
+    }
+    grain = std::max(grain, 1u);
+    JobCounter counter;
+    auto split = [this, count, grain, &body, &counter] {
+        SplitRange(0, count, grain, &body, &counter);
+    };
+    Spawn(split, &counter);
+    Wait(counter);
+}
+
+void JobSystem::SplitRange(uint32_t begin,
+    uint32_t end,
+    uint32_t grain,
+    const std::function<void(uint32_t, uint32_t)>* body,
+    JobCounter* counter) {
+    // Keep the front half, offer the back half to thieves
+    while (end - begin > grain) {
+        const uint32_t middle = begin + (end - begin) / 2;
+        auto split = [this, middle, end, grain, body, counter] {
+            SplitRange(middle, end, grain, body, counter);
+        };
+        Spawn(split, counter);
+        end = middle;
+    }
+    (*body)(begin, end);
+}
+
+JobSystemStats JobSystem::stats() const {
+    JobSystemStats stats;
+    for (const auto& worker : workers_) {
+        stats.jobs_executed +=
+            worker->jobs_executed.load(std::memory_order_relaxed);
+        stats.steals += worker->steals.load(std::memory_order_relaxed);
+    }
+    stats.injected = injected_total_.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void JobSystem::WorkerLoop(uint32_t index) {
+    Worker* worker = workers_[index].get();
+    tls_binding = {this, worker};
+    uint32_t idle_spins = 0;
+    while (!stopping_.load(std::memory_order_acquire)) {
+        if (Job* job = FindJob(worker)) {
+            Execute(job, worker);
+            idle_spins = 0;
+            continue;
+        }
+        if (++idle_spins < kSpinsBeforeSleep) {
+            std::this_thread::yield();
+            continue;
+        }
+        // Announce the sleep before the last look, Push() checks
+        // sleeping_ after publishing its job
+        sleeping_.fetch_add(1, std::memory_order_seq_cst);
+        const uint32_t epoch = wake_epoch_.load(std::memory_order_seq_cst);
+        Job* job = FindJob(worker);
+        if (!job && !stopping_.load(std::memory_order_seq_cst)) {
+            wake_epoch_.wait(epoch, std::memory_order_seq_cst);
+        }
+        sleeping_.fetch_sub(1, std::memory_order_relaxed);
+        if (job) {
+            Execute(job, worker);
+        }
+        idle_spins = 0;
+    }
+    tls_binding = {};
+}
+
+void JobSystem::Push(Job* job) {
+    Worker* worker = CurrentWorker();
+    if (!worker || !worker->deque.Push(job)) {
+        std::lock_guard lock(injected_mutex_);
+        injected_jobs_.push_back(job);
+        injected_count_.fetch_add(1, std::memory_order_release);
+        injected_total_.fetch_add(1, std::memory_order_relaxed);
+    }
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleeping_.load(std::memory_order_relaxed) > 0) {
+        wake_epoch_.fetch_add(1, std::memory_order_seq_cst);
+        wake_epoch_.notify_one();
+    }
+}
+
+void JobSystem::Release(const std::vector<Job*>& jobs) {
+    for (Job* job : jobs) {
+        Push(job);
+    }
+}
+
+Job* JobSystem::FindJob(Worker* worker) {
+    if (worker) {
+        if (Job* job = worker->deque.Pop()) {
+            return job;
+        }
+    }
+    if (injected_count_.load(std::memory_order_acquire) > 0) {
+        std::lock_guard lock(injected_mutex_);
+        if (!injected_jobs_.empty()) {
+            Job* job = injected_jobs_.front();
+            injected_jobs_.pop_front();
+            injected_count_.fetch_sub(1, std::memory_order_relaxed);
+            return job;
+        }
+    }
+    return StealJob(worker);
+}
+
+Job* JobSystem::StealJob(Worker* worker) {
+    const uint32_t count = thread_count();
+    uint32_t& random_state =
+        worker ? worker->random_state : tls_random_state;
+    const uint32_t start = NextRandom(random_state) % count;
+    for (uint32_t i = 0; i < count; i++) {
+        Worker* victim = workers_[(start + i) % count].get();
+        if (victim == worker) {
+            continue;
+        }
+        if (Job* job = victim->deque.Steal()) {
+            if (worker) {
+                worker->steals.fetch_add(1, std::memory_order_relaxed);
+            }
+            return job;
+        }
+    }
+    return nullptr;
+}
+
+void JobSystem::Execute(Job* job, Worker* worker) {
+    std::exception_ptr error;
+    try {
+        job->function();
+    } catch (...) {
+        error = std::current_exception();
+    }
+    JobCounter* signal = job->signal;
+    delete job;
+    if (worker) {
+        worker->jobs_executed.fetch_add(1, std::memory_order_relaxed);
+    }
+    Complete(signal, error);
+}
+
+void JobSystem::Complete(JobCounter* signal, std::exception_ptr error) {
+    if (!signal) {
+        if (error) {
+            std::terminate();
+        }
+        return;
+    }
+    Release(signal->Finish(error));
+}
+
+}  // namespace engine_jobs
@@ -0,0 +1,195 @@
+
+#ifndef ENGINE_JOBS_JOB_SYSTEM_H_
+#define ENGINE_JOBS_JOB_SYSTEM_H_
+
+#include <atomic>
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "job_deque.h"
+
+namespace engine_jobs {
+
+struct JobCounter;
+struct JobSystem;
+
+struct Job {
+    std::function<void()> function;
+    JobCounter* signal = nullptr;
+};
+
+// Jobs in flight that were spawned with this counter as their signal.
+// Jobs spawned with it as their dependency are parked until it reaches
+// zero. The first exception thrown by a signalling job is kept and
+// rethrown by JobSystem::Wait or by co_await JobSystem::Until.
+// Reaching zero is the last access of the finishing job, so the counter
+// may be destroyed as soon as Done() returns true. New jobs may only be
+// added while another of its jobs is in flight, or once it is done.
+struct JobCounter {
+   public:
+    JobCounter() = default;
+    // No copy
+    JobCounter(const JobCounter&) = delete;
+    JobCounter& operator=(const JobCounter&) = delete;
+    bool Done() const {
+        return count_.load(std::memory_order_acquire) == 0;
+    }
+
+   private:
+    friend struct JobSystem;
+    void Add();
+    // Parks `job` until the count reaches zero. False if it already has,
+    // or if only a finishing job is left.
+    bool Defer(Job* job);
+    // Returns the continuations released by the last finishing job.
+    std::vector<Job*> Finish(std::exception_ptr error);
+    // Returns the stored exception, if any. Only valid once Done().
+    std::exception_ptr TakeError();
+    std::atomic<uint32_t> count_{0};
+    std::mutex mutex_;
+    std::vector<Job*> continuations_;
+    std::exception_ptr error_;
+    // Set by the last job once it took the continuations, until the
+    // counter is reused
+    bool closing_ = false;
+};
+
+// Coroutine job. The body starts when the task is spawned and may
+// co_await JobSystem::Until() to suspend without holding a thread; it
+// resumes as a fresh job on whichever worker frees the counter.
+struct JobTask {
+    struct promise_type;
+    using Handle = std::coroutine_handle<promise_type>;
+    struct FinalAwaiter {
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(Handle handle) noexcept;
+        void await_resume() const noexcept {}
+    };
+    struct promise_type {
+        JobSystem* system = nullptr;
+        JobCounter* signal = nullptr;
+        std::exception_ptr error;
+        JobTask get_return_object() {
+            return JobTask(Handle::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        FinalAwaiter final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { error = std::current_exception(); }
+    };
+
+    explicit JobTask(Handle handle) : handle(handle) {}
+    JobTask(JobTask&& other) noexcept
+        : handle(std::exchange(other.handle, nullptr)) {}
+    // No copy
+    JobTask(const JobTask&) = delete;
+    JobTask& operator=(const JobTask&) = delete;
+    ~JobTask() {
+        if (handle) {
+            handle.destroy();
+        }
+    }
+    Handle handle;
+};
+
+struct JobSystemStats {
+    uint64_t jobs_executed = 0;
+    uint64_t steals = 0;
+    uint64_t injected = 0;
+};
+
+// Work-stealing scheduler. Each worker owns a JobDeque: jobs spawned on
+// a worker go to its own deque, idle workers steal from a random victim,
+// and threads outside the pool feed a shared injection queue. Waiting
+// never blocks a worker; Wait() runs other jobs until the counter is
+// done, so jobs can spawn and wait on nested work freely.
+struct JobSystem {
+   public:
+    // `thread_count` includes the constructing thread, which runs jobs
+    // whenever it waits. 0 picks one thread per hardware thread.
+    explicit JobSystem(uint32_t thread_count = 0);
+    ~JobSystem();
+    // No copy
+    JobSystem(const JobSystem&) = delete;
+    JobSystem& operator=(const JobSystem&) = delete;
+
+    static constexpr uint32_t kNotAWorker = ~0u;
+
+    uint32_t thread_count() const {
+        return static_cast<uint32_t>(workers_.size());
+    }
+    // Index in [0, thread_count()) of the calling pool thread, the
+    // constructing thread being 0, for per-thread resources such as
+    // command pools. kNotAWorker on any other thread.
+    uint32_t CurrentThreadIndex() const;
+    // `signal`, if given, is incremented now and decremented once the job
+    // ran. With a `dependency` the job only becomes runnable when that
+    // counter reaches zero. Jobs without a signal must not throw.
+    void Spawn(std::function<void()> function,
+        JobCounter* signal = nullptr,
+        JobCounter* dependency = nullptr);
+    void Spawn(JobTask task, JobCounter* signal = nullptr);
+    void Wait(JobCounter& counter);
+    // Calls body(begin, end) over [0, count) in ranges of at most `grain`
+    // items. Ranges are split in halves on demand so thieves take large
+    // pieces first. Returns when every range ran.
+    void ParallelFor(uint32_t count,
+        uint32_t grain,
+        const std::function<void(uint32_t, uint32_t)>& body);
+
+    struct CounterAwaiter {
+        JobSystem& system;
+        JobCounter& counter;
+        bool await_ready() const { return counter.Done(); }
+        void await_suspend(std::coroutine_handle<> handle);
+        void await_resume();
+    };
+    // co_await inside a JobTask to resume once `counter` is done.
+    CounterAwaiter Until(JobCounter& counter) { return {*this, counter}; }
+
+    JobSystemStats stats() const;
+
+   private:
+    friend struct JobTask;
+    struct Worker {
+        JobDeque deque;
+        std::thread thread;
+        uint32_t index;
+        uint32_t random_state;
+        std::atomic<uint64_t> jobs_executed{0};
+        std::atomic<uint64_t> steals{0};
+    };
+    static constexpr uint32_t kSpinsBeforeSleep = 64;
+    Worker* CurrentWorker() const;
+    void WorkerLoop(uint32_t index);
+    void Push(Job* job);
+    void Release(const std::vector<Job*>& jobs);
+    Job* FindJob(Worker* worker);
+    Job* StealJob(Worker* worker);
+    void Execute(Job* job, Worker* worker);
+    void Complete(JobCounter* signal, std::exception_ptr error);
+    void SplitRange(uint32_t begin,
+        uint32_t end,
+        uint32_t grain,
+        const std::function<void(uint32_t, uint32_t)>* body,
+        JobCounter* counter);
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::mutex injected_mutex_;
+    std::deque<Job*> injected_jobs_;
+    std::atomic<uint32_t> injected_count_{0};
+    std::atomic<uint64_t> injected_total_{0};
+    std::atomic<uint32_t> sleeping_{0};
+    std::atomic<uint32_t> wake_epoch_{0};
+    std::atomic<bool> stopping_{false};
+};
+}  // namespace engine_jobs
+
+#endif
@@ -0,0 +1,64 @@
+#include "task_graph.h"
+
+#include <stdexcept>
+
+namespace engine_jobs {
+
+TaskGraph::NodeId TaskGraph::Add(std::function<void()> function) {
+    auto node = std::make_unique<Node>();
+    node->function = std::move(function);
+    nodes_.push_back(std::move(node));
+    return static_cast<NodeId>(nodes_.size() - 1);
+}
+
+void TaskGraph::Precede(NodeId before, NodeId after) {
+    if (before >= nodes_.size() || after >= nodes_.size() ||
+        before == after) {
+        throw std::invalid_argument("invalid task graph edge!");
+    }
+    nodes_[before]->successors.push_back(after);
+    nodes_[after]->predecessors++;
+}
+
+void TaskGraph::Run(JobSystem& system, JobCounter& signal) {
+    std::vector<NodeId> roots;
+    for (NodeId id = 0; id < nodes_.size(); id++) {
+        nodes_[id]->remaining.store(nodes_[id]->predecessors,
+            std::memory_order_relaxed);
+        if (nodes_[id]->predecessors == 0) {
+            roots.push_back(id);
+        }
+    }
+    if (roots.empty() && !nodes_.empty()) {
+        throw std::runtime_error("task graph has no root node!");
+    }
+    for (NodeId id : roots) {
+        SpawnNode(system, signal, id);
+    }
+}
+
+void TaskGraph::RunAndWait(JobSystem& system) {
+    JobCounter signal;
+    Run(system, signal);
+    system.Wait(signal);
+}
+
+void TaskGraph::SpawnNode(JobSystem& system,
+    JobCounter& signal,
+    NodeId id) {
+    // Successors are spawned from inside the finishing node, so the
+    // signal never drops to zero between two nodes
+    auto run = [this, &system, &signal, id] {
+        Node& node = *nodes_[id];
+        node.function();
+        for (NodeId successor : node.successors) {
+            if (nodes_[successor]->remaining.fetch_sub(1,
+                    std::memory_order_acq_rel) == 1) {
+                SpawnNode(system, signal, successor);
+            }
+        }
+    };
+    system.Spawn(run, &signal);
+}
+
+}  // namespace engine_jobs
@@ -0,0 +1,52 @@
+
+#ifndef ENGINE_JOBS_TASK_GRAPH_H_
+#define ENGINE_JOBS_TASK_GRAPH_H_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "job_system.h"
+
+namespace engine_jobs {
+
+// Static dependency graph of jobs, built once and run any number of
+// times, e.g. the init steps or one frame's CPU work. A node becomes
+// runnable when all of its predecessors finished; a node that throws
+// cancels its successors and the error reaches whoever waits on the
+// signal. The graph must not change or run twice concurrently while a
+// run is in flight.
+struct TaskGraph {
+   public:
+    using NodeId = uint32_t;
+
+    TaskGraph() = default;
+    // No copy
+    TaskGraph(const TaskGraph&) = delete;
+    TaskGraph& operator=(const TaskGraph&) = delete;
+
+    NodeId Add(std::function<void()> function);
+    // `after` waits for `before`.
+    void Precede(NodeId before, NodeId after);
+    // Spawns the root nodes and returns. `signal` is done once every node
+    // ran.
+    void Run(JobSystem& system, JobCounter& signal);
+    // Run() and wait for it.
+    void RunAndWait(JobSystem& system);
+    size_t size() const { return nodes_.size(); }
+
+   private:
+    struct Node {
+        std::function<void()> function;
+        std::vector<NodeId> successors;
+        uint32_t predecessors = 0;
+        std::atomic<uint32_t> remaining{0};
+    };
+    void SpawnNode(JobSystem& system, JobCounter& signal, NodeId id);
+    std::vector<std::unique_ptr<Node>> nodes_;
+};
+}  // namespace engine_jobs
+
+#endif
@@ -1,14 +1,194 @@
+#extension GL_EXT_buffer_reference : enable
 
+// 24 bytes instead of four vec3s and a bool: octahedral normal, unorm8
+// albedo and RGB9E5 emission. A miss leaves albedo alpha at zero.
 struct HitPayload
 {
     vec3 position;
-    vec3 normal;
-    vec3 emission;
-    vec3 brdf;
-    bool done;
+    uint normal;
+    uint albedo;
+    uint emission;
 };
 
+// Scene data is reached through device addresses rather than fixed
+// descriptor bindings, so any number of meshes shares one descriptor set.
+layout(buffer_reference, std430, buffer_reference_align = 4) readonly buffer Vertices{float vertices[];};
+layout(buffer_reference, std430, buffer_reference_align = 4) readonly buffer Indices{uint indices[];};
+layout(buffer_reference, std430, buffer_reference_align = 4) readonly buffer Faces{float faces[];};
+// Packed normal, albedo and emission per primitive, see PrimitiveInfo
+layout(buffer_reference, std430, buffer_reference_align = 4) readonly buffer Primitives{uint primitives[];};
+// Pixels still above the error target, as y * width + x
+layout(buffer_reference, std430, buffer_reference_align = 4) buffer ActivePixels{uint pixels[];};
+
+// Must match SceneInstance in context.cc
+struct SceneInstance
+{
+    Vertices vertices;
+    Indices indices;
+    Faces faces;
+    Primitives primitives;
+};
+
+// Must match EmissiveTriangle in context.cc
+struct EmissiveTriangle
+{
+    vec3 p0;
+    float area;
+    vec3 e1;
+    uint emission;
+    vec3 e2;
+    uint normal;
+};
+
+struct AliasEntry
+{
+    float probability;
+    uint alias;
+};
+
+layout(buffer_reference, std430, buffer_reference_align = 16) readonly buffer EmissiveTriangles{EmissiveTriangle triangles[];};
+layout(buffer_reference, std430, buffer_reference_align = 8) readonly buffer AliasTable{AliasEntry entries[];};
+
 const highp float M_PI = 3.14159265358979323846;
+// Path segments per sample. Must match kMaxPathDepth in context.cc.
+const uint MAX_DEPTH = 8;
+
+// Rec. 709 luma of linear radiance
+float luminance(vec3 c)
+{
+    return dot(c, vec3(0.2126, 0.7152, 0.0722));
+}
+
+float powerHeuristic(float pdfA, float pdfB)
+{
+    const float a = pdfA * pdfA;
+    const float b = pdfB * pdfB;
+    return a / max(a + b, 1e-20);
+}
+
+vec2 signNotZero(vec2 v)
+{
+    return vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+uint packOctahedral(vec3 n)
+{
+    vec2 p = n.xy / (abs(n.x) + abs(n.y) + abs(n.z));
+    if(n.z < 0.0)
+        p = (1.0 - abs(p.yx)) * signNotZero(p);
+    return packSnorm2x16(p);
+}
+
+vec3 unpackOctahedral(uint packed)
+{
+    vec2 p = unpackSnorm2x16(packed);
+    vec3 n = vec3(p, 1.0 - abs(p.x) - abs(p.y));
+    if(n.z < 0.0)
+        n.xy = (1.0 - abs(n.yx)) * signNotZero(n.xy);
+    return normalize(n);
+}
+
+// Shared-exponent HDR color, same layout as VK_FORMAT_E5B9G9R9
+uint packRGB9E5(vec3 c)
+{
+    c = clamp(c, vec3(0.0), vec3(65408.0));
+    float maxC = max(max(c.r, c.g), max(c.b, exp2(-16.0)));
+    int exponent = max(-16, int(floor(log2(maxC)))) + 16;
+    float denom = exp2(float(exponent - 24));
+    if(int(floor(maxC / denom + 0.5)) == 512){
+        denom *= 2.0;
+        exponent++;
+    }
+    uvec3 m = uvec3(floor(c / denom + 0.5));
+    return m.r | (m.g << 9) | (m.b << 18) | (uint(exponent) << 27);
+}
+
+vec3 unpackRGB9E5(uint v)
+{
+    float scale = exp2(float(int(v >> 27) - 24));
+    return vec3(v & 511u, (v >> 9) & 511u, (v >> 18) & 511u) * scale;
+}
+
+// Sampling module. SAMPLE_BRDF draws directions proportional to the
+// material's BRDF times cosine; for the Lambertian materials in use that
+// is the cosine lobe, so it only differs once other lobes are added.
+const uint SAMPLE_UNIFORM = 0u;
+const uint SAMPLE_COSINE = 1u;
+const uint SAMPLE_BRDF = 2u;
+
+struct BsdfSample
+{
+    vec3 direction;
+    float pdf;
+};
+
+void createCoordinateSystem(in vec3 N, out vec3 T, out vec3 B)
+{
+    if(abs(N.x) > abs(N.y))
+        T = vec3(N.z, 0, -N.x) / sqrt(N.x * N.x + N.z * N.z);
+    else
+        T = vec3(0, -N.z, N.y) / sqrt(N.y * N.y + N.z * N.z);
+    B = cross(N, T);
+}
+
+vec3 toWorld(vec3 dir, vec3 normal)
+{
+    vec3 tangent;
+    vec3 bitangent;
+    createCoordinateSystem(normal, tangent, bitangent);
+    return dir.x * tangent + dir.y * bitangent + dir.z * normal;
+}
+
+vec3 sampleUniformHemisphere(vec2 u)
+{
+    const float r = sqrt(max(1.0 - u.x * u.x, 0.0));
+    return vec3(cos(2.0 * M_PI * u.y) * r, sin(2.0 * M_PI * u.y) * r, u.x);
+}
+
+vec3 sampleCosineHemisphere(vec2 u)
+{
+    const float r = sqrt(u.x);
+    const float phi = 2.0 * M_PI * u.y;
+    return vec3(r * cos(phi), r * sin(phi), sqrt(max(1.0 - u.x, 0.0)));
+}
+
+float bsdfPdf(uint mode, vec3 normal, vec3 direction)
+{
+    const float cosTheta = dot(normal, direction);
+    if(cosTheta <= 0.0){
+        return 0.0;
+    }
+    return mode == SAMPLE_UNIFORM ? 1.0 / (2.0 * M_PI) : cosTheta / M_PI;
+}
+
+BsdfSample sampleBsdf(uint mode, vec2 u, vec3 normal)
+{
+    BsdfSample bs;
+    const vec3 local = mode == SAMPLE_UNIFORM ? sampleUniformHemisphere(u) : sampleCosineHemisphere(u);
+    bs.direction = toWorld(local, normal);
+    bs.pdf = mode == SAMPLE_UNIFORM ? 1.0 / (2.0 * M_PI) : local.z / M_PI;
+    return bs;
+}
+
+// Throughput-based Russian roulette. Returns false when the path is
+// terminated; surviving paths are reweighted to stay unbiased.
+bool russianRoulette(inout vec3 weight, uint depth, uint minDepth, float u)
+{
+    if(depth < minDepth){
+        return true;
+    }
+    const float survive = clamp(max(weight.r, max(weight.g, weight.b)), 0.05, 0.95);
+    if(u >= survive){
+        return false;
+    }
+    weight /= survive;
+    return true;
+}
+
+bool payloadMissed(HitPayload p)
+{
+    return (p.albedo >> 24) == 0u;
+}
 
 uint pcg(inout uint state)
 {
@@ -0,0 +1,69 @@
+// Equirectangular HDR environment with texel importance sampling. Needs
+// common.glsl. The loader negates y, so world -y is the zenith and v = 0
+// the top row of the map.
+
+// RGB9E5 texels, row major
+layout(buffer_reference, std430, buffer_reference_align = 4) readonly buffer EnvironmentTexels{uint texels[];};
+
+struct Environment
+{
+    EnvironmentTexels texels;
+    // Over texels, proportional to luminance * sin(theta) of the row
+    AliasTable aliasTable;
+    uint width;
+    uint height;
+    // 1 / sum of the alias table weights
+    float weightScale;
+};
+
+vec2 environmentUV(vec3 direction)
+{
+    return vec2(atan(direction.z, direction.x) / (2.0 * M_PI) + 0.5,
+        acos(clamp(-direction.y, -1.0, 1.0)) / M_PI);
+}
+
+vec3 environmentDirection(vec2 uv)
+{
+    const float phi = (uv.x - 0.5) * 2.0 * M_PI;
+    const float theta = uv.y * M_PI;
+    return vec3(sin(theta) * cos(phi), -cos(theta), sin(theta) * sin(phi));
+}
+
+uvec2 environmentTexel(Environment env, vec2 uv)
+{
+    return min(uvec2(uv * vec2(env.width, env.height)), uvec2(env.width - 1, env.height - 1));
+}
+
+vec3 environmentRadiance(Environment env, vec3 direction)
+{
+    const uvec2 texel = environmentTexel(env, environmentUV(direction));
+    return unpackRGB9E5(env.texels.texels[texel.y * env.width + texel.x]);
+}
+
+// Solid angle pdf of sampleEnvironment. The texel weight is recomputed
+// exactly as on the CPU, so the estimator stays unbiased.
+float environmentPdf(Environment env, vec3 direction)
+{
+    const uvec2 texel = environmentTexel(env, environmentUV(direction));
+    const vec3 radiance = unpackRGB9E5(env.texels.texels[texel.y * env.width + texel.x]);
+    const float rowSinTheta = sin(M_PI * (float(texel.y) + 0.5) / float(env.height));
+    const float probability = luminance(radiance) * rowSinTheta * env.weightScale;
+    const float sinTheta = sqrt(max(1.0 - direction.y * direction.y, 0.0));
+    return probability * float(env.width * env.height) / (2.0 * M_PI * M_PI * max(sinTheta, 1e-6));
+}
+
+// Texel from the alias table, u.x picking the slot and u.y tossing its
+// coin, then a uniform point inside it
+vec3 sampleEnvironment(Environment env, vec2 u, vec2 jitter, out float pdf)
+{
+    const uint count = env.width * env.height;
+    uint index = min(uint(u.x * float(count)), count - 1);
+    const AliasEntry entry = env.aliasTable.entries[index];
+    if(u.y >= entry.probability){
+        index = entry.alias;
+    }
+    const vec2 uv = (vec2(index % env.width, index / env.width) + jitter) / vec2(env.width, env.height);
+    const vec3 direction = environmentDirection(uv);
+    pdf = environmentPdf(env, direction);
+    return direction;
+}
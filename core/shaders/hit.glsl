@@ -0,0 +1,70 @@
+// Hit record of a triangle, shared by closesthit.rchit and the ray query
+// backend in rayquery.comp so both produce the same payload. Needs
+// common.glsl.
+
+struct Vertex
+{
+    vec3 position;
+};
+
+struct Face
+{
+    vec3 diffuse;
+    vec3 emission;
+};
+
+Vertex unpackVertex(Vertices vertices, uint index)
+{
+    uint stride = 3;
+    uint offset = index * stride;
+    Vertex v;
+    v.position = vec3(vertices.vertices[offset +  0], vertices.vertices[offset +  1], vertices.vertices[offset + 2]);
+    return v;
+}
+
+Face unpackFace(Faces faces, uint index)
+{
+    uint stride = 6;
+    uint offset = index * stride;
+    Face f;
+    f.diffuse = vec3(faces.faces[offset +  0], faces.faces[offset +  1], faces.faces[offset + 2]);
+    f.emission = vec3(faces.faces[offset +  3], faces.faces[offset +  4], faces.faces[offset + 5]);
+    return f;
+}
+
+vec3 calcNormal(Vertex v0, Vertex v1, Vertex v2)
+{
+    vec3 e01 = v1.position - v0.position;
+    vec3 e02 = v2.position - v0.position;
+    return -normalize(cross(e01, e02));
+}
+
+// `position` is the ray origin plus direction times the hit distance.
+// With `usePrimitiveInfo` the per-primitive record built at load time is
+// copied instead of rebuilding the face normal from three vertices.
+HitPayload hitPayload(SceneInstance instance, uint primitive, vec2 attribs, vec3 position, bool usePrimitiveInfo)
+{
+    HitPayload hit;
+    if(usePrimitiveInfo){
+        const uint offset = 3 * primitive;
+        hit.position = position;
+        hit.normal = instance.primitives.primitives[offset + 0];
+        hit.albedo = instance.primitives.primitives[offset + 1];
+        hit.emission = instance.primitives.primitives[offset + 2];
+        return hit;
+    }
+
+    const Vertex v0 = unpackVertex(instance.vertices, instance.indices.indices[3 * primitive + 0]);
+    const Vertex v1 = unpackVertex(instance.vertices, instance.indices.indices[3 * primitive + 1]);
+    const Vertex v2 = unpackVertex(instance.vertices, instance.indices.indices[3 * primitive + 2]);
+
+    const vec3 barycentricCoords = vec3(1.0f - attribs.x - attribs.y, attribs.x, attribs.y);
+    const vec3 normal = calcNormal(v0, v1, v2);
+
+    const Face face = unpackFace(instance.faces, primitive);
+    hit.position = v0.position * barycentricCoords.x + v1.position * barycentricCoords.y + v2.position * barycentricCoords.z;
+    hit.normal = packOctahedral(normal);
+    hit.albedo = packUnorm4x8(vec4(face.diffuse, 1.0));
+    hit.emission = packRGB9E5(face.emission);
+    return hit;
+}
@@ -0,0 +1,123 @@
+// Next-event estimation shared by the megakernel in raygen.rgen and the
+// wavefront shade stage in wavefront.comp. Needs common.glsl,
+// sampler.glsl and environment.glsl, and expects lightCount, lightArea,
+// lightTriangles, lightAliasTable, environment() and SAMPLING_MODE in
+// scope. Samples come back without a visibility test; the caller traces
+// or queues the shadow ray.
+
+// Next-event estimation picks the environment with this probability
+// when emissive triangles are sampled at the same vertex
+const float ENVIRONMENT_SELECT_PROBABILITY = 0.5;
+
+// Shadow ray to test and what it adds if unoccluded, already divided by
+// the pdf and MIS-weighted. A zero distance means no ray is needed.
+struct LightSample
+{
+    vec3 direction;
+    float distance;
+    vec3 contribution;
+};
+
+// Solid angle pdf of hitting `lightNormal` at `dist` when lights are
+// chosen proportional to area
+float lightPdf(float dist, vec3 lightNormal, vec3 direction)
+{
+    const float cosLight = abs(dot(lightNormal, direction));
+    return dist * dist / max(cosLight * lightArea, 1e-20);
+}
+
+// Light index proportional to area: u.x picks the slot, u.y is the
+// alias coin. The fraction of the scaled slot sample would leave the
+// coin only the bits the table size does not use.
+uint selectLight(vec2 u)
+{
+    const uint index = min(uint(u.x * float(lightCount)), lightCount - 1);
+    const AliasEntry entry = lightAliasTable.entries[index];
+    return u.y < entry.probability ? index : entry.alias;
+}
+
+// One point on an emissive triangle, MIS-weighted against the BSDF
+// sampling of the bounce. `selectProbability` is the chance triangles
+// were chosen over the environment.
+LightSample sampleTriangleLight(vec3 position, vec3 normal, vec3 brdf, float selectProbability, inout Sampler rng)
+{
+    LightSample ls = LightSample(vec3(0.0), 0.0, vec3(0.0));
+    const EmissiveTriangle light = lightTriangles.triangles[selectLight(sample2D(rng))];
+
+    const vec2 uv = sample2D(rng);
+    float u = uv.x;
+    float v = uv.y;
+    if(u + v > 1.0){
+        u = 1.0 - u;
+        v = 1.0 - v;
+    }
+    const vec3 lightPosition = light.p0 + u * light.e1 + v * light.e2;
+    const vec3 toLight = lightPosition - position;
+    const float dist = length(toLight);
+    const vec3 direction = toLight / dist;
+    const float cosSurface = dot(normal, direction);
+    const float pdf = selectProbability * lightPdf(dist, unpackOctahedral(light.normal), direction);
+    if(cosSurface <= 0.0 || pdf >= 1e19){
+        return ls;
+    }
+
+    const vec3 emission = unpackRGB9E5(light.emission);
+    const float misWeight = powerHeuristic(pdf, bsdfPdf(SAMPLING_MODE, normal, direction));
+    ls.direction = direction;
+    ls.distance = dist;
+    ls.contribution = brdf * emission * cosSurface * misWeight / pdf;
+    return ls;
+}
+
+// One importance-sampled environment direction, MIS-weighted against the
+// BSDF sampling of the bounce
+LightSample sampleEnvironmentLight(vec3 position, vec3 normal, vec3 brdf, float selectProbability, inout Sampler rng)
+{
+    LightSample ls = LightSample(vec3(0.0), 0.0, vec3(0.0));
+    const Environment env = environment();
+    float pdf;
+    const vec2 u = sample2D(rng);
+    const vec3 direction = sampleEnvironment(env, u, sample2D(rng), pdf);
+    pdf *= selectProbability;
+    const float cosSurface = dot(normal, direction);
+    if(cosSurface <= 0.0 || pdf <= 0.0){
+        return ls;
+    }
+    const float misWeight = powerHeuristic(pdf, bsdfPdf(SAMPLING_MODE, normal, direction));
+    ls.direction = direction;
+    ls.distance = 10000.0;
+    ls.contribution = brdf * environmentRadiance(env, direction) * cosSurface * misWeight / pdf;
+    return ls;
+}
+
+// Chooses between the environment and the triangles and samples it.
+// The choice probabilities are kept for the MIS weight of whatever the
+// BSDF ray hits next. ReSTIR keeps triangles out with `triangles` false.
+LightSample sampleDirectLight(vec3 position, vec3 normal, vec3 brdf, bool triangles, out float triangleSelect, out float environmentSelect, inout Sampler rng)
+{
+    environmentSelect = triangles ? ENVIRONMENT_SELECT_PROBABILITY : 1.0;
+    triangleSelect = 1.0 - environmentSelect;
+    if(sample1D(rng) < environmentSelect){
+        return sampleEnvironmentLight(position, normal, brdf, environmentSelect, rng);
+    }
+    return sampleTriangleLight(position, normal, brdf, triangleSelect, rng);
+}
+
+// MIS weights of emission found by BSDF sampling, given the choice
+// probabilities of next-event estimation at the previous vertex (zero
+// when it did not run)
+float triangleHitWeight(float bsdfPdf, float triangleSelect, float dist, vec3 lightNormal, vec3 direction)
+{
+    if(triangleSelect <= 0.0){
+        return 1.0;
+    }
+    return powerHeuristic(bsdfPdf, triangleSelect * lightPdf(dist, lightNormal, direction));
+}
+
+float environmentHitWeight(float bsdfPdf, float environmentSelect, vec3 direction)
+{
+    if(environmentSelect <= 0.0){
+        return 1.0;
+    }
+    return powerHeuristic(bsdfPdf, environmentSelect * environmentPdf(environment(), direction));
+}
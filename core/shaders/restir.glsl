@@ -0,0 +1,67 @@
+// Reservoir resampling of direct light (ReSTIR DI). Initial candidates
+// come from raygen.rgen, temporal and spatial reuse from restir.comp.
+// Needs common.glsl.
+
+// One light sample selected for the surface it was drawn at. Must match
+// Reservoir in context.cc.
+struct Reservoir
+{
+    vec3 position;
+    uint normal;        // Octahedral
+    uint light;         // Index into the emissive triangles
+    uint barycentrics;  // unorm16x2, folded into the triangle when read
+    float W;            // Unbiased contribution weight, 1 / pdf estimate
+    float M;            // Candidates seen
+};
+layout(buffer_reference, std430, buffer_reference_align = 16) buffer Reservoirs{Reservoir reservoirs[];};
+
+struct LightPoint
+{
+    vec3 position;
+    vec3 normal;
+    vec3 emission;
+};
+
+LightPoint lightPoint(EmissiveTriangles triangles, uint index, uint barycentrics)
+{
+    const EmissiveTriangle light = triangles.triangles[index];
+    vec2 uv = unpackUnorm2x16(barycentrics);
+    if(uv.x + uv.y > 1.0){
+        uv = 1.0 - uv;
+    }
+    LightPoint point;
+    point.position = light.p0 + uv.x * light.e1 + uv.y * light.e2;
+    point.normal = unpackOctahedral(light.normal);
+    point.emission = unpackRGB9E5(light.emission);
+    return point;
+}
+
+// Unshadowed contribution in area measure, without the diffuse albedo
+// which scales every candidate alike
+float restirTarget(vec3 position, vec3 normal, LightPoint light)
+{
+    const vec3 toLight = light.position - position;
+    const float dist2 = dot(toLight, toLight);
+    if(dist2 <= 0.0){
+        return 0.0;
+    }
+    const vec3 direction = toLight * inversesqrt(dist2);
+    const float cosSurface = dot(normal, direction);
+    if(cosSurface <= 0.0){
+        return 0.0;
+    }
+    return luminance(light.emission) * cosSurface * abs(dot(light.normal, direction)) / dist2;
+}
+
+// Streaming RIS step: keeps the new sample with probability
+// weight / weightSum
+bool updateReservoir(inout Reservoir r, inout float weightSum, uint light, uint barycentrics, float weight, float u)
+{
+    weightSum += weight;
+    if(weight > 0.0 && u * weightSum < weight){
+        r.light = light;
+        r.barycentrics = barycentrics;
+        return true;
+    }
+    return false;
+}
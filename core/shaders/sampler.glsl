@@ -0,0 +1,120 @@
+// Sampler subsystem: Owen-scrambled Sobol points with a per-pixel
+// blue-noise toroidal shift, so the error of neighbouring pixels is
+// decorrelated at low sample counts. Every path dimension draws a padded
+// 2D sample from its own shuffled and scrambled copy of the (0, 1) Sobol
+// pair (Burley 2020). The tables come from SamplerTables in context.cc.
+
+layout(buffer_reference, std430, buffer_reference_align = 4) readonly buffer SobolDirections{uint directions[];};
+layout(buffer_reference, std430, buffer_reference_align = 4) readonly buffer BlueNoise{float noise[];};
+
+// Must match buildSobolDirections() and kBlueNoiseSize in context.cc
+const uint SOBOL_BITS = 32u;
+const uint BLUE_NOISE_SIZE = 64u;
+
+struct Sampler
+{
+    SobolDirections sobolDirections;
+    BlueNoise blueNoise;
+    uvec2 pixel;
+    uint index;     // Sample index, running over frames
+    uint dimension; // Next path dimension
+    uint seed;      // PCG state when Sobol is disabled
+    bool sobol;
+};
+
+uint hashUint(uint x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+uint sobol(SobolDirections table, uint index, uint dim)
+{
+    uint x = 0u;
+    const uint base = dim * SOBOL_BITS;
+    for(uint bit = 0u; index != 0u; bit++, index >>= 1u){
+        if((index & 1u) != 0u){
+            x ^= table.directions[base + bit];
+        }
+    }
+    return x;
+}
+
+uint laineKarrasPermutation(uint x, uint seed)
+{
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+}
+
+uint nestedUniformScramble(uint x, uint seed)
+{
+    x = bitfieldReverse(x);
+    x = laineKarrasPermutation(x, seed);
+    return bitfieldReverse(x);
+}
+
+// R2 offsets give every dimension its own view of the blue-noise tile
+float blueNoiseShift(Sampler s, uint channel)
+{
+    const vec2 r2 = vec2(0.7548776662, 0.5698402910);
+    const uvec2 offset = uvec2(fract(r2 * float(channel)) * float(BLUE_NOISE_SIZE));
+    const uvec2 texel = (s.pixel + offset) % BLUE_NOISE_SIZE;
+    return s.blueNoise.noise[texel.y * BLUE_NOISE_SIZE + texel.x];
+}
+
+Sampler createSampler(SobolDirections sobolDirections, BlueNoise blueNoise, uvec2 pixel, uint index, bool useSobol)
+{
+    Sampler s;
+    s.sobolDirections = sobolDirections;
+    s.blueNoise = blueNoise;
+    s.pixel = pixel;
+    s.index = index;
+    s.dimension = 0u;
+    const uvec2 h = pcg2d(pixel * (index + 1u));
+    s.seed = h.x + h.y;
+    s.sobol = useSobol;
+    return s;
+}
+
+vec2 sample2D(inout Sampler s)
+{
+    if(!s.sobol){
+        return vec2(rand(s.seed), rand(s.seed));
+    }
+    const uint dimSeed = hashUint(s.dimension * 0x9e3779b9u + 0x85ebca6bu);
+    const uint index = nestedUniformScramble(s.index, dimSeed);
+    const uint x = nestedUniformScramble(sobol(s.sobolDirections, index, 0u), hashUint(dimSeed ^ 0x68bc21ebu));
+    const uint y = nestedUniformScramble(sobol(s.sobolDirections, index, 1u), hashUint(dimSeed ^ 0x02e5be93u));
+    vec2 u = vec2(x, y) * exp2(-32.0);
+    u = fract(u + vec2(blueNoiseShift(s, 2u * s.dimension), blueNoiseShift(s, 2u * s.dimension + 1u)));
+    s.dimension++;
+    return min(u, vec2(0.99999994));
+}
+
+float sample1D(inout Sampler s)
+{
+    return sample2D(s).x;
+}
+// Everything the sample sequence advances in one word, the dimension for
+// Sobol and the PCG state otherwise, so a path can wait in a queue
+uint samplerState(Sampler s)
+{
+    return s.sobol ? s.dimension : s.seed;
+}
+
+void restoreSamplerState(inout Sampler s, uint state)
+{
+    if(s.sobol){
+        s.dimension = state;
+    }else{
+        s.seed = state;
+    }
+}
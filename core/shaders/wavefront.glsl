@@ -0,0 +1,72 @@
+// Queues of the wavefront path tracer. wavefront.comp generates and
+// shades paths, raygen.rgen traces the extension and shadow queues in
+// between. Needs common.glsl.
+
+// One path waiting for its next segment to be traced
+struct PathState
+{
+    vec3 origin;
+    uint pixel;         // y * width + x
+    vec3 direction;
+    uint sampleIndex;
+    vec3 throughput;
+    float lastBsdfPdf;
+    uint depth;
+    uint samplerState;  // See samplerState() in sampler.glsl
+    // Next-event estimation choice at the previous vertex, for MIS
+    float lastTriangleSelect;
+    float lastEnvironmentSelect;
+};
+
+struct ShadowRay
+{
+    vec3 origin;
+    uint pixel;
+    vec3 direction;
+    float distance;
+    vec3 contribution;
+    uint pad;
+};
+
+// Append counter followed by the indirect arguments of its consumers:
+// groups of WAVEFRONT_GROUP_SIZE for compute and a width x 1 x 1 trace.
+// Must match QueueCounter in context.cc.
+struct QueueCounter
+{
+    uint count;
+    uint groupsX;
+    uint groupsY;
+    uint groupsZ;
+    uint width;
+    uint height;
+    uint depth;
+    uint pad;
+};
+
+const uint WAVEFRONT_GROUP_SIZE = 64u;
+// Hits are binned by material before shading. Bin 0 holds misses, bin 1
+// emitters and the rest diffuse surfaces hashed by albedo.
+const uint MATERIAL_BINS = 16u;
+
+layout(buffer_reference, std430, buffer_reference_align = 16) buffer PathStates{PathState paths[];};
+layout(buffer_reference, std430, buffer_reference_align = 16) buffer HitRecords{HitPayload hits[];};
+layout(buffer_reference, std430, buffer_reference_align = 16) buffer ShadowRays{ShadowRay rays[];};
+layout(buffer_reference, std430, buffer_reference_align = 4) buffer QueueIndices{uint indices[];};
+// Radiance of each pixel's current path in rgb
+layout(buffer_reference, std430, buffer_reference_align = 16) buffer PathRadiance{vec4 radiance[];};
+
+// Must match WavefrontState in context.cc. Extension queues ping-pong
+// between bounces; hits, sort keys and the sorted order are indexed like
+// the queue that was just traced.
+layout(buffer_reference, std430, buffer_reference_align = 16) buffer WavefrontState{
+    QueueCounter rayCounters[2];
+    QueueCounter shadowCounter;
+    uint binCounts[MATERIAL_BINS];
+    uint binStarts[MATERIAL_BINS];
+    PathStates rays[2];
+    HitRecords hits;
+    ShadowRays shadows;
+    QueueIndices sortKeys;
+    QueueIndices sorted;
+    PathRadiance radiance;
+};
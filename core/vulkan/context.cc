@@ -4,7 +4,7 @@
 #include <memory>
 
 #include "command_pool.h"
-#include "descriptor_pool.h"
+#include "descriptor_allocator.h"
 #include "surface.h"
 #include "vulkan/context.h"
 #include "vulkan/debug_messenger.h"
@@ -16,6 +16,19 @@
 #include "vulkan/window_handle.h"
 
 namespace engine_init {
+
+namespace {
+// Per-set descriptor mix of the ray tracing and compute passes.
+const std::vector<DescriptorPoolRatio> kDescriptorPoolRatios{
+    {vk::DescriptorType::eAccelerationStructureKHR, 1.0f},
+    {vk::DescriptorType::eStorageImage, 2.0f},
+    {vk::DescriptorType::eStorageBuffer, 2.0f},
+    {vk::DescriptorType::eUniformBuffer, 1.0f},
+    {vk::DescriptorType::eCombinedImageSampler, 1.0f},
+};
+constexpr uint32_t kInitialDescriptorSets = 16;
+}  // namespace
+
 Context::Context() {
     InitVulkan();
 }
@@ -32,7 +45,19 @@ void Context::InitVulkan() {
     swapchain =
         std::make_unique<Swapchain>(*device, *surface, *queue_family);
     command_pool = std::make_unique<CommandPool>(*device, *queue_family);
-    descriptor_pool = std::make_unique<DescriptorPool>(*device);
+    descriptor_allocator = std::make_unique<DescriptorAllocator>(
+        device->device(),
+        kInitialDescriptorSets,
+        kDescriptorPoolRatios);
+    if (device->bindless_supported()) {
+        bindless_descriptors = std::make_unique<BindlessDescriptorSet>(
+            *device,
+            *physical_device);
+    } else {
+        std::cout << "Descriptor indexing is not supported, no bindless "
+                     "descriptor set."
+                  << std::endl;
+    }
 
     std::cout << "Finished initializing engine.";
 }
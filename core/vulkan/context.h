@@ -4,7 +4,7 @@
 
 #include "command_pool.h"
 #include "debug_messenger.h"
-#include "descriptor_pool.h"
+#include "descriptor_allocator.h"
 #include "queue.h"
 #include "swapchain.h"
 
@@ -27,7 +27,9 @@ struct Context {
     std::unique_ptr<Queue> queue;
     std::unique_ptr<Swapchain> swapchain;
     std::unique_ptr<CommandPool> command_pool;
-    std::unique_ptr<DescriptorPool> descriptor_pool;
+    std::unique_ptr<DescriptorAllocator> descriptor_allocator;
+    // Null when the device lacks the descriptor indexing features
+    std::unique_ptr<BindlessDescriptorSet> bindless_descriptors;
     void InitVulkan();
 };
 }  // namespace engine_init
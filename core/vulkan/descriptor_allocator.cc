@@ -0,0 +1,208 @@
+#include "descriptor_allocator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "vulkan/vulkan.hpp"
+
+namespace engine_init {
+
+DescriptorAllocator::DescriptorAllocator(vk::Device device,
+    uint32_t initial_sets,
+    const std::vector<DescriptorPoolRatio>& ratios)
+    : device_(device), ratios_(ratios), sets_per_pool_(initial_sets) {
+    current_pool_ = GrowPool();
+}
+
+std::unique_ptr<DescriptorPool> DescriptorAllocator::CreatePool(
+    uint32_t max_sets) {
+    std::vector<vk::DescriptorPoolSize> pool_sizes;
+    for (const DescriptorPoolRatio& ratio : ratios_) {
+        pool_sizes.emplace_back(ratio.type,
+            static_cast<uint32_t>(std::ceil(ratio.ratio * max_sets)));
+    }
+    stats_.pools_created++;
+    stats_.pool_count++;
+    return std::make_unique<DescriptorPool>(device_,
+        max_sets,
+        pool_sizes);
+}
+
+std::unique_ptr<DescriptorPool> DescriptorAllocator::GrowPool() {
+    std::unique_ptr<DescriptorPool> pool = CreatePool(sets_per_pool_);
+    sets_per_pool_ = std::min(sets_per_pool_ * 3 / 2 + 1, kMaxSetsPerPool);
+    return pool;
+}
+
+vk::DescriptorSet DescriptorAllocator::Allocate(
+    vk::DescriptorSetLayout layout,
+    uint32_t variable_descriptor_count) {
+    vk::DescriptorSet descriptor_set = current_pool_->Allocate(
+        device_, layout, variable_descriptor_count);
+    if (!descriptor_set) {
+        stats_.exhausted_pools++;
+        full_pools_.push_back(std::move(current_pool_));
+        current_pool_ = GrowPool();
+        descriptor_set = current_pool_->Allocate(
+            device_, layout, variable_descriptor_count);
+        if (!descriptor_set) {
+            throw std::runtime_error(
+                "descriptor set does not fit in a fresh pool!");
+        }
+    }
+    stats_.sets_allocated++;
+    stats_.sets_in_use++;
+    return descriptor_set;
+}
+
+void DescriptorAllocator::ResetPools() {
+    if (full_pools_.empty()) {
+        current_pool_->Reset(device_);
+        stats_.pool_resets++;
+        stats_.sets_in_use = 0;
+        return;
+    }
+
+    // The chain overflowed since the last reset. Replace it with one pool
+    // sized for the whole chain so the next frame needs a single reset.
+    uint32_t total_sets = current_pool_->max_sets();
+    for (const auto& pool : full_pools_) {
+        total_sets += pool->max_sets();
+    }
+    stats_.pool_count -= static_cast<uint32_t>(full_pools_.size() + 1);
+    full_pools_.clear();
+    sets_per_pool_ = std::min(total_sets, kMaxSetsPerPool);
+    current_pool_ = CreatePool(sets_per_pool_);
+    stats_.sets_in_use = 0;
+}
+
+uint32_t BindlessDescriptorSet::SlotList::Acquire() {
+    if (!free.empty()) {
+        uint32_t index = free.back();
+        free.pop_back();
+        return index;
+    }
+    if (next == capacity) {
+        throw std::runtime_error("bindless descriptor array is full!");
+    }
+    return next++;
+}
+
+BindlessDescriptorSet::BindlessDescriptorSet(const Device& device,
+    const PhysicalDevice& physical_device,
+    uint32_t max_sampled_images,
+    uint32_t max_storage_images)
+    : device_(device) {
+    auto properties =
+        physical_device.physical_device()
+            .getProperties2<vk::PhysicalDeviceProperties2,
+                vk::PhysicalDeviceDescriptorIndexingProperties>();
+    auto indexing_properties =
+        properties.get<vk::PhysicalDeviceDescriptorIndexingProperties>();
+    sampled_slots_.capacity = std::min(max_sampled_images,
+        indexing_properties
+            .maxDescriptorSetUpdateAfterBindSampledImages);
+    storage_slots_.capacity = std::min(max_storage_images,
+        indexing_properties
+            .maxDescriptorSetUpdateAfterBindStorageImages);
+
+    CreateLayout(device.device());
+    CreateDescriptorSet(device.device());
+}
+
+void BindlessDescriptorSet::CreateLayout(const vk::Device& device) {
+    std::vector<vk::DescriptorSetLayoutBinding> bindings{
+        {kSampledImageBinding,
+            vk::DescriptorType::eCombinedImageSampler,
+            sampled_slots_.capacity,
+            vk::ShaderStageFlagBits::eAll},
+        {kStorageImageBinding,
+            vk::DescriptorType::eStorageImage,
+            storage_slots_.capacity,
+            vk::ShaderStageFlagBits::eAll},
+    };
+
+    using Flag = vk::DescriptorBindingFlagBits;
+    std::vector<vk::DescriptorBindingFlags> binding_flags{
+        Flag::eUpdateAfterBind | Flag::ePartiallyBound
+            | Flag::eUpdateUnusedWhilePending,
+        Flag::eUpdateAfterBind | Flag::ePartiallyBound
+            | Flag::eUpdateUnusedWhilePending,
+    };
+    vk::DescriptorSetLayoutBindingFlagsCreateInfo binding_flags_info;
+    binding_flags_info.setBindingFlags(binding_flags);
+
+    vk::DescriptorSetLayoutCreateInfo layout_info;
+    layout_info.setBindings(bindings);
+    layout_info.setFlags(
+        vk::DescriptorSetLayoutCreateFlagBits::eUpdateAfterBindPool);
+    layout_info.setPNext(&binding_flags_info);
+    layout_ = device.createDescriptorSetLayoutUnique(layout_info);
+}
+
+void BindlessDescriptorSet::CreateDescriptorSet(const vk::Device& device) {
+    std::vector<vk::DescriptorPoolSize> pool_sizes{
+        {vk::DescriptorType::eCombinedImageSampler,
+            sampled_slots_.capacity},
+        {vk::DescriptorType::eStorageImage, storage_slots_.capacity},
+    };
+    pool_ = std::make_unique<DescriptorPool>(device,
+        1,
+        pool_sizes,
+        vk::DescriptorPoolCreateFlagBits::eUpdateAfterBind);
+    descriptor_set_ = pool_->Allocate(device, *layout_);
+    if (!descriptor_set_) {
+        throw std::runtime_error("failed to allocate bindless set!");
+    }
+}
+
+uint32_t BindlessDescriptorSet::RegisterSampledImage(vk::ImageView view,
+    vk::Sampler sampler,
+    vk::ImageLayout layout) {
+    uint32_t index = sampled_slots_.Acquire();
+    pending_writes_.push_back({kSampledImageBinding,
+        index,
+        vk::DescriptorType::eCombinedImageSampler,
+        {sampler, view, layout}});
+    return index;
+}
+
+uint32_t BindlessDescriptorSet::RegisterStorageImage(vk::ImageView view) {
+    uint32_t index = storage_slots_.Acquire();
+    pending_writes_.push_back({kStorageImageBinding,
+        index,
+        vk::DescriptorType::eStorageImage,
+        {{}, view, vk::ImageLayout::eGeneral}});
+    return index;
+}
+
+// Partially bound arrays tolerate stale entries as long as shaders do not
+// read them, so releasing a slot only recycles its index.
+void BindlessDescriptorSet::ReleaseSampledImage(uint32_t index) {
+    sampled_slots_.free.push_back(index);
+}
+
+void BindlessDescriptorSet::ReleaseStorageImage(uint32_t index) {
+    storage_slots_.free.push_back(index);
+}
+
+void BindlessDescriptorSet::Flush() {
+    if (pending_writes_.empty()) {
+        return;
+    }
+    std::vector<vk::WriteDescriptorSet> writes;
+    writes.reserve(pending_writes_.size());
+    for (const PendingWrite& pending : pending_writes_) {
+        vk::WriteDescriptorSet& write = writes.emplace_back();
+        write.setDstSet(descriptor_set_);
+        write.setDstBinding(pending.binding);
+        write.setDstArrayElement(pending.array_element);
+        write.setDescriptorType(pending.type);
+        write.setImageInfo(pending.image_info);
+    }
+    device_.device().updateDescriptorSets(writes, nullptr);
+    pending_writes_.clear();
+}
+
+}  // namespace engine_init
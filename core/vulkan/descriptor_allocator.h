@@ -0,0 +1,116 @@
+
+#ifndef VK_INIT_DESCRIPTOR_ALLOCATOR_H_
+#define VK_INIT_DESCRIPTOR_ALLOCATOR_H_
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "descriptor_pool.h"
+#include "device.h"
+#include "physical_device.h"
+
+namespace engine_init {
+
+// Descriptors reserved per set, per type, in every pool of an allocator.
+struct DescriptorPoolRatio {
+    vk::DescriptorType type;
+    float ratio;
+};
+
+struct DescriptorAllocatorStats {
+    uint32_t pool_count = 0;
+    uint32_t pools_created = 0;
+    uint32_t sets_allocated = 0;
+    uint32_t sets_in_use = 0;
+    uint32_t pool_resets = 0;
+    uint32_t exhausted_pools = 0;
+};
+
+// Chains descriptor pools and grows the next one when the current one is
+// exhausted. ResetPools() recycles every pool with one reset per pool;
+// after a reset the chain is collapsed into a single pool big enough for
+// the previous peak, so steady state is one vkResetDescriptorPool call.
+struct DescriptorAllocator {
+   public:
+    DescriptorAllocator(vk::Device device,
+        uint32_t initial_sets,
+        const std::vector<DescriptorPoolRatio>& ratios);
+    // No copy
+    DescriptorAllocator(const DescriptorAllocator&) = delete;
+    DescriptorAllocator& operator=(const DescriptorAllocator&) = delete;
+
+    vk::DescriptorSet Allocate(vk::DescriptorSetLayout layout,
+        uint32_t variable_descriptor_count = 0);
+    void ResetPools();
+    const DescriptorAllocatorStats& stats() const { return stats_; }
+
+   private:
+    static constexpr uint32_t kMaxSetsPerPool = 4096;
+    std::unique_ptr<DescriptorPool> CreatePool(uint32_t max_sets);
+    std::unique_ptr<DescriptorPool> GrowPool();
+    vk::Device device_;
+    std::vector<DescriptorPoolRatio> ratios_;
+    std::vector<std::unique_ptr<DescriptorPool>> full_pools_;
+    std::unique_ptr<DescriptorPool> current_pool_;
+    uint32_t sets_per_pool_;
+    DescriptorAllocatorStats stats_;
+};
+
+// A single update-after-bind set holding partially bound arrays of
+// sampled and storage images. Resources are registered once and then
+// addressed by index from shaders, so binding new textures never touches
+// the pipeline layout or reallocates descriptor sets.
+struct BindlessDescriptorSet {
+   public:
+    static constexpr uint32_t kSampledImageBinding = 0;
+    static constexpr uint32_t kStorageImageBinding = 1;
+
+    BindlessDescriptorSet(const Device& device,
+        const PhysicalDevice& physical_device,
+        uint32_t max_sampled_images = 4096,
+        uint32_t max_storage_images = 1024);
+    // No copy
+    BindlessDescriptorSet(const BindlessDescriptorSet&) = delete;
+    BindlessDescriptorSet& operator=(const BindlessDescriptorSet&) =
+        delete;
+
+    vk::DescriptorSetLayout layout() const { return layout_.get(); }
+    vk::DescriptorSet descriptor_set() const { return descriptor_set_; }
+
+    uint32_t RegisterSampledImage(vk::ImageView view,
+        vk::Sampler sampler,
+        vk::ImageLayout layout = vk::ImageLayout::eShaderReadOnlyOptimal);
+    uint32_t RegisterStorageImage(vk::ImageView view);
+    void ReleaseSampledImage(uint32_t index);
+    void ReleaseStorageImage(uint32_t index);
+    // Pushes every pending registration in one vkUpdateDescriptorSets.
+    void Flush();
+
+   private:
+    struct PendingWrite {
+        uint32_t binding;
+        uint32_t array_element;
+        vk::DescriptorType type;
+        vk::DescriptorImageInfo image_info;
+    };
+    struct SlotList {
+        uint32_t capacity = 0;
+        uint32_t next = 0;
+        std::vector<uint32_t> free;
+        uint32_t Acquire();
+    };
+    void CreateLayout(const vk::Device& device);
+    void CreateDescriptorSet(const vk::Device& device);
+    const Device& device_;
+    SlotList sampled_slots_;
+    SlotList storage_slots_;
+    vk::UniqueDescriptorSetLayout layout_;
+    std::unique_ptr<DescriptorPool> pool_;
+    vk::DescriptorSet descriptor_set_;
+    std::vector<PendingWrite> pending_writes_;
+};
+}  // namespace engine_init
+
+#endif
@@ -4,18 +4,49 @@
 
 namespace engine_init {
 
-DescriptorPool::DescriptorPool(const Device& device) {
-    CreateDescriptorPool(device.device());
+DescriptorPool::DescriptorPool(const vk::Device& device,
+    uint32_t max_sets,
+    const std::vector<vk::DescriptorPoolSize>& pool_sizes,
+    vk::DescriptorPoolCreateFlags flags)
+    : max_sets_(max_sets) {
+    CreateDescriptorPool(device, pool_sizes, flags);
 }
 
-void DescriptorPool::CreateDescriptorPool(const vk::Device& device) {
+void DescriptorPool::CreateDescriptorPool(const vk::Device& device,
+    const std::vector<vk::DescriptorPoolSize>& pool_sizes,
+    vk::DescriptorPoolCreateFlags flags) {
     vk::DescriptorPoolCreateInfo descriptor_pool_info;
     descriptor_pool_info.setPoolSizes(pool_sizes);
-    descriptor_pool_info.setMaxSets(1);
-    descriptor_pool_info.setFlags(
-        vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet);
+    descriptor_pool_info.setMaxSets(max_sets_);
+    descriptor_pool_info.setFlags(flags);
     descriptor_pool_ =
         device.createDescriptorPoolUnique(descriptor_pool_info);
 }
 
-}  // namespace engine_init
\ No newline at end of file
+vk::DescriptorSet DescriptorPool::Allocate(const vk::Device& device,
+    vk::DescriptorSetLayout layout,
+    uint32_t variable_descriptor_count) {
+    vk::DescriptorSetAllocateInfo allocate_info;
+    allocate_info.setDescriptorPool(*descriptor_pool_);
+    allocate_info.setSetLayouts(layout);
+
+    vk::DescriptorSetVariableDescriptorCountAllocateInfo variable_info;
+    if (variable_descriptor_count > 0) {
+        variable_info.setDescriptorCounts(variable_descriptor_count);
+        allocate_info.setPNext(&variable_info);
+    }
+
+    try {
+        return device.allocateDescriptorSets(allocate_info).front();
+    } catch (const vk::OutOfPoolMemoryError&) {
+        return nullptr;
+    } catch (const vk::FragmentedPoolError&) {
+        return nullptr;
+    }
+}
+
+void DescriptorPool::Reset(const vk::Device& device) {
+    device.resetDescriptorPool(*descriptor_pool_);
+}
+
+}  // namespace engine_init
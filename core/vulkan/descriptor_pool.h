@@ -2,31 +2,41 @@
 #ifndef VK_INIT_DESCRIPTOR_POOL_H_
 #define VK_INIT_DESCRIPTOR_POOL_H_
 
+#include <vector>
 #include <vulkan/vulkan.hpp>
 
-#include "device.h"
-
 namespace engine_init {
 
+// A single fixed-size descriptor pool. Growth, chaining and per-frame
+// reuse live in DescriptorAllocator.
 struct DescriptorPool {
    public:
-    DescriptorPool(const Device& device);
+    DescriptorPool(const vk::Device& device,
+        uint32_t max_sets,
+        const std::vector<vk::DescriptorPoolSize>& pool_sizes,
+        vk::DescriptorPoolCreateFlags flags = {});
     // No copy
     DescriptorPool(const DescriptorPool&) = delete;
     DescriptorPool& operator=(const DescriptorPool&) = delete;
     vk::DescriptorPool descriptor_pool() const {
         return descriptor_pool_.get();
     }
+    uint32_t max_sets() const { return max_sets_; }
+
+    // Returns a null handle when the pool is exhausted or fragmented so
+    // the caller can move on to another pool.
+    vk::DescriptorSet Allocate(const vk::Device& device,
+        vk::DescriptorSetLayout layout,
+        uint32_t variable_descriptor_count = 0);
+    void Reset(const vk::Device& device);
 
    private:
-    void CreateDescriptorPool(const vk::Device& device);
+    void CreateDescriptorPool(const vk::Device& device,
+        const std::vector<vk::DescriptorPoolSize>& pool_sizes,
+        vk::DescriptorPoolCreateFlags flags);
     vk::UniqueDescriptorPool descriptor_pool_;
-    std::vector<vk::DescriptorPoolSize> pool_sizes{
-        {vk::DescriptorType::eAccelerationStructureKHR, 1},
-        {vk::DescriptorType::eStorageImage, 1},
-        {vk::DescriptorType::eStorageBuffer, 3},
-    };
+    uint32_t max_sets_;
 };
 }  // namespace engine_init
 
-#endif
\ No newline at end of file
+#endif
@@ -11,15 +11,20 @@ namespace engine_init {
 Device::Device(const PhysicalDevice& physical_device,
     const QueueFamily& queue_family) {
     CreateDevice(physical_device.physical_device(),
-        queue_family.queue_family_index());
+        queue_family.unique_family_indices());
 }
 
 void Device::CreateDevice(const vk::PhysicalDevice& physical_device,
-    const size_t& queue_family_index) {
+    const std::vector<uint32_t>& queue_family_indices) {
+    // One queue per family in use; roles that share a family share it
     const float queuePriority = 1.0f;
-    vk::DeviceQueueCreateInfo queue_create_info;
-    queue_create_info.setQueueFamilyIndex(queue_family_index);
-    queue_create_info.setQueuePriorities(queuePriority);
+    std::vector<vk::DeviceQueueCreateInfo> queue_create_infos;
+    for (uint32_t queue_family_index : queue_family_indices) {
+        vk::DeviceQueueCreateInfo queue_create_info;
+        queue_create_info.setQueueFamilyIndex(queue_family_index);
+        queue_create_info.setQueuePriorities(queuePriority);
+        queue_create_infos.push_back(queue_create_info);
+    }
 
     const std::vector device_extensions{
         VK_KHR_SWAPCHAIN_EXTENSION_NAME,
@@ -39,18 +44,53 @@ void Device::CreateDevice(const vk::PhysicalDevice& physical_device,
     }
 
     vk::DeviceCreateInfo device_info;
-    device_info.setQueueCreateInfos(queue_create_info);
+    device_info.setQueueCreateInfos(queue_create_infos);
     device_info.setPEnabledExtensionNames(device_extensions);
 
-    vk::PhysicalDeviceBufferDeviceAddressFeatures
-        buffer_device_address_features{true};
+    // Descriptor indexing features are enabled as far as the device
+    // supports them; the bindless set needs the ones checked below.
+    const vk::PhysicalDeviceVulkan12Features supported =
+        physical_device
+            .getFeatures2<vk::PhysicalDeviceFeatures2,
+                vk::PhysicalDeviceVulkan12Features>()
+            .get<vk::PhysicalDeviceVulkan12Features>();
+    vk::PhysicalDeviceVulkan12Features vulkan12_features;
+    vulkan12_features.setBufferDeviceAddress(true);
+    vulkan12_features.setDescriptorIndexing(supported.descriptorIndexing);
+    vulkan12_features.setRuntimeDescriptorArray(
+        supported.runtimeDescriptorArray);
+    vulkan12_features.setDescriptorBindingPartiallyBound(
+        supported.descriptorBindingPartiallyBound);
+    vulkan12_features.setDescriptorBindingVariableDescriptorCount(
+        supported.descriptorBindingVariableDescriptorCount);
+    vulkan12_features.setDescriptorBindingUpdateUnusedWhilePending(
+        supported.descriptorBindingUpdateUnusedWhilePending);
+    vulkan12_features.setDescriptorBindingSampledImageUpdateAfterBind(
+        supported.descriptorBindingSampledImageUpdateAfterBind);
+    vulkan12_features.setDescriptorBindingStorageImageUpdateAfterBind(
+        supported.descriptorBindingStorageImageUpdateAfterBind);
+    vulkan12_features.setShaderSampledImageArrayNonUniformIndexing(
+        supported.shaderSampledImageArrayNonUniformIndexing);
+    vulkan12_features.setShaderStorageImageArrayNonUniformIndexing(
+        supported.shaderStorageImageArrayNonUniformIndexing);
+    bindless_supported_ =
+        supported.runtimeDescriptorArray
+        && supported.descriptorBindingPartiallyBound
+        && supported.descriptorBindingUpdateUnusedWhilePending
+        && supported.descriptorBindingSampledImageUpdateAfterBind
+        && supported.descriptorBindingStorageImageUpdateAfterBind;
+    // Cross-queue sync and queue family ownership transfers
+    vulkan12_features.setTimelineSemaphore(true);
+    vk::PhysicalDeviceVulkan13Features vulkan13_features;
+    vulkan13_features.setSynchronization2(true);
     vk::PhysicalDeviceRayTracingPipelineFeaturesKHR
         ray_tracing_pipeline_features{true};
     vk::PhysicalDeviceAccelerationStructureFeaturesKHR
         acceleration_structure_features{true};
     vk::StructureChain createInfoChain{
         device_info,
-        buffer_device_address_features,
+        vulkan12_features,
+        vulkan13_features,
         ray_tracing_pipeline_features,
         acceleration_structure_features,
     };
@@ -17,14 +17,18 @@ struct Device {
     Device(const Device&) = delete;
     Device& operator=(const Device&) = delete;
     vk::Device device() const { return device_.get(); }
+    // Whether the descriptor indexing features BindlessDescriptorSet
+    // relies on were enabled
+    bool bindless_supported() const { return bindless_supported_; }
 
    private:
     void CreateDevice(const vk::PhysicalDevice& physical_deivce,
-        const size_t& queue_family_index);
+        const std::vector<uint32_t>& queue_family_indices);
     bool CheckDeviceExtensionSupport(
         const vk::PhysicalDevice& physical_deivce,
         const std::vector<const char*>& required_extensions) const;
     vk::UniqueDevice device_;
+    bool bindless_supported_ = false;
 };
 }  // namespace engine_init
 
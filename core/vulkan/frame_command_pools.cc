@@ -0,0 +1,128 @@
+#include "frame_command_pools.h"
+
+#include <stdexcept>
+
+#include "vulkan/vulkan.hpp"
+
+namespace engine_init {
+
+FrameCommandPools::FrameCommandPools(vk::Device device,
+    uint32_t queue_family_index,
+    uint32_t frames_in_flight,
+    uint32_t thread_count)
+    : device_(device), thread_count_(thread_count) {
+    vk::CommandPoolCreateInfo command_pool_info;
+    command_pool_info.setFlags(vk::CommandPoolCreateFlagBits::eTransient);
+    command_pool_info.setQueueFamilyIndex(queue_family_index);
+    pools_.resize(frames_in_flight * thread_count);
+    for (ThreadPool& pool : pools_) {
+        pool.pool = device.createCommandPoolUnique(command_pool_info);
+    }
+    stats_.pool_count = static_cast<uint32_t>(pools_.size());
+}
+
+void FrameCommandPools::BeginFrame(uint32_t frame_index) {
+    frame_index_ = frame_index;
+    for (uint32_t i = 0; i < thread_count_; i++) {
+        ThreadPool& pool = pools_[frame_index * thread_count_ + i];
+        if (pool.primaries_used == 0 && pool.secondaries_used == 0) {
+            continue;
+        }
+        device_.resetCommandPool(pool.pool.get());
+        pool.primaries_used = 0;
+        pool.secondaries_used = 0;
+        stats_.pool_resets++;
+    }
+}
+
+FrameCommandPools::ThreadPool& FrameCommandPools::CurrentPool(
+    uint32_t thread_index) {
+    if (thread_index >= thread_count_) {
+        throw std::out_of_range(
+            "command buffers must be recorded on a pool thread!");
+    }
+    return pools_[frame_index_ * thread_count_ + thread_index];
+}
+
+vk::CommandBuffer FrameCommandPools::Acquire(ThreadPool& pool,
+    vk::CommandBufferLevel level) {
+    const bool primary = level == vk::CommandBufferLevel::ePrimary;
+    std::vector<vk::CommandBuffer>& cache =
+        primary ? pool.primaries : pool.secondaries;
+    uint32_t& used = primary ? pool.primaries_used : pool.secondaries_used;
+    if (used == cache.size()) {
+        vk::CommandBufferAllocateInfo allocate_info;
+        allocate_info.setCommandPool(pool.pool.get());
+        allocate_info.setLevel(level);
+        allocate_info.setCommandBufferCount(1);
+        std::vector<vk::CommandBuffer> allocated =
+            device_.allocateCommandBuffers(allocate_info);
+        cache.push_back(allocated.front());
+        pool.allocated++;
+    }
+    return cache[used++];
+}
+
+vk::CommandBuffer FrameCommandPools::AllocatePrimary(
+    uint32_t thread_index) {
+    return Acquire(CurrentPool(thread_index),
+        vk::CommandBufferLevel::ePrimary);
+}
+
+vk::CommandBuffer FrameCommandPools::AllocateSecondary(
+    uint32_t thread_index) {
+    return Acquire(CurrentPool(thread_index),
+        vk::CommandBufferLevel::eSecondary);
+}
+
+std::vector<vk::CommandBuffer> FrameCommandPools::Record(
+    engine_jobs::JobSystem& jobs,
+    vk::CommandBufferLevel level,
+    const vk::CommandBufferInheritanceInfo* inheritance,
+    const std::vector<RecordFunction>& passes) {
+    std::vector<vk::CommandBuffer> command_buffers(passes.size());
+    auto record = [&](uint32_t begin, uint32_t end) {
+        ThreadPool& pool = CurrentPool(jobs.CurrentThreadIndex());
+        for (uint32_t i = begin; i < end; i++) {
+            vk::CommandBuffer command_buffer = Acquire(pool, level);
+            vk::CommandBufferBeginInfo begin_info;
+            begin_info.setFlags(
+                vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
+            begin_info.setPInheritanceInfo(inheritance);
+            command_buffer.begin(begin_info);
+            passes[i](command_buffer);
+            command_buffer.end();
+            command_buffers[i] = command_buffer;
+        }
+    };
+    jobs.ParallelFor(static_cast<uint32_t>(passes.size()), 1, record);
+
+    stats_.command_buffers_allocated = 0;
+    for (const ThreadPool& pool : pools_) {
+        stats_.command_buffers_allocated += pool.allocated;
+    }
+    return command_buffers;
+}
+
+std::vector<vk::CommandBuffer> FrameCommandPools::RecordPrimaries(
+    engine_jobs::JobSystem& jobs,
+    const std::vector<RecordFunction>& passes) {
+    return Record(jobs, vk::CommandBufferLevel::ePrimary, nullptr, passes);
+}
+
+void FrameCommandPools::RecordSecondaries(engine_jobs::JobSystem& jobs,
+    vk::CommandBuffer primary,
+    const std::vector<RecordFunction>& passes) {
+    // Trace and compute passes run outside render passes, so there is
+    // nothing to inherit
+    const vk::CommandBufferInheritanceInfo inheritance;
+    const std::vector<vk::CommandBuffer> secondaries = Record(jobs,
+        vk::CommandBufferLevel::eSecondary,
+        &inheritance,
+        passes);
+    if (!secondaries.empty()) {
+        primary.executeCommands(secondaries);
+    }
+}
+
+}  // namespace engine_init
@@ -0,0 +1,81 @@
+
+#ifndef VK_INIT_FRAME_COMMAND_POOLS_H_
+#define VK_INIT_FRAME_COMMAND_POOLS_H_
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "jobs/job_system.h"
+
+namespace engine_init {
+
+struct FrameCommandPoolStats {
+    uint32_t pool_count = 0;
+    uint32_t command_buffers_allocated = 0;
+    uint32_t pool_resets = 0;
+};
+
+// One transient command pool per frame in flight per recording thread.
+// BeginFrame() resets every pool of the frame being reused with one
+// vkResetCommandPool each; command buffers are never freed or reset one
+// by one and are handed out again from the pool's cache next time.
+// A pool is only touched by its thread, so recording needs no locks.
+struct FrameCommandPools {
+   public:
+    using RecordFunction = std::function<void(vk::CommandBuffer)>;
+
+    FrameCommandPools(vk::Device device,
+        uint32_t queue_family_index,
+        uint32_t frames_in_flight,
+        uint32_t thread_count);
+    // No copy
+    FrameCommandPools(const FrameCommandPools&) = delete;
+    FrameCommandPools& operator=(const FrameCommandPools&) = delete;
+
+    // The caller must guarantee the GPU finished frame_index's last use.
+    void BeginFrame(uint32_t frame_index);
+    vk::CommandBuffer AllocatePrimary(uint32_t thread_index);
+    vk::CommandBuffer AllocateSecondary(uint32_t thread_index);
+
+    // Records each pass into its own primary on whichever worker picks it
+    // up. The result is in pass order, ready to go into one submit so
+    // the GPU executes the passes in that order.
+    std::vector<vk::CommandBuffer> RecordPrimaries(
+        engine_jobs::JobSystem& jobs,
+        const std::vector<RecordFunction>& passes);
+    // Records the passes into secondaries in parallel and executes them
+    // in pass order from `primary`, which must be recording.
+    void RecordSecondaries(engine_jobs::JobSystem& jobs,
+        vk::CommandBuffer primary,
+        const std::vector<RecordFunction>& passes);
+
+    const FrameCommandPoolStats& stats() const { return stats_; }
+
+   private:
+    struct ThreadPool {
+        vk::UniqueCommandPool pool;
+        std::vector<vk::CommandBuffer> primaries;
+        std::vector<vk::CommandBuffer> secondaries;
+        uint32_t primaries_used = 0;
+        uint32_t secondaries_used = 0;
+        uint32_t allocated = 0;
+    };
+    ThreadPool& CurrentPool(uint32_t thread_index);
+    vk::CommandBuffer Acquire(ThreadPool& pool,
+        vk::CommandBufferLevel level);
+    std::vector<vk::CommandBuffer> Record(engine_jobs::JobSystem& jobs,
+        vk::CommandBufferLevel level,
+        const vk::CommandBufferInheritanceInfo* inheritance,
+        const std::vector<RecordFunction>& passes);
+    vk::Device device_;
+    uint32_t thread_count_;
+    // frames_in_flight x thread_count, frame major
+    std::vector<ThreadPool> pools_;
+    uint32_t frame_index_ = 0;
+    FrameCommandPoolStats stats_;
+};
+}  // namespace engine_init
+
+#endif
@@ -8,6 +8,7 @@ namespace engine_init {
 
 Queue::Queue(const Device& device, const QueueFamily& queue_family) {
     PickQueue(device.device(), queue_family.queue_family_index());
+    PickRoleQueues(device.device(), queue_family);
 }
 
 void Queue::PickQueue(const vk::Device& device,
@@ -15,4 +16,28 @@ void Queue::PickQueue(const vk::Device& device,
     queue_ = device.getQueue(queue_family_index, 0);
 }
 
-}  // namespace engine_init
\ No newline at end of file
+void Queue::PickRoleQueues(const vk::Device& device,
+    const QueueFamily& queue_family) {
+    for (size_t role = 0; role < kRoleCount; role++) {
+        const uint32_t family =
+            queue_family.family_index(static_cast<QueueRole>(role));
+        queues_[role] = device.getQueue(family, 0);
+        lock_index_[role] = role;
+        for (size_t other = 0; other < role; other++) {
+            if (queues_[other] == queues_[role]) {
+                lock_index_[role] = lock_index_[other];
+                break;
+            }
+        }
+    }
+}
+
+void Queue::Submit(QueueRole role,
+    const vk::SubmitInfo2& submit_info,
+    vk::Fence fence) {
+    const size_t index = static_cast<size_t>(role);
+    std::lock_guard lock(mutexes_[lock_index_[index]]);
+    queues_[index].submit2(submit_info, fence);
+}
+
+}  // namespace engine_init
@@ -2,12 +2,17 @@
 #ifndef VK_INIT_QUEUE_H_
 #define VK_INIT_QUEUE_H_
 
+#include <array>
+#include <mutex>
 #include <vulkan/vulkan.hpp>
 
 #include "device.h"
 
 namespace engine_init {
 
+// Queue 0 of every family QueueFamily picked. Roles without a dedicated
+// family hand out the graphics queue, so callers submit by role and get
+// overlap wherever the hardware allows it.
 struct Queue {
    public:
     Queue(const Device& device, const QueueFamily& queue_family);
@@ -15,11 +20,26 @@ struct Queue {
     Queue(const Queue&) = delete;
     Queue& operator=(const Queue&) = delete;
     vk::Queue queue() const { return queue_; }
+    vk::Queue queue(QueueRole role) const {
+        return queues_[static_cast<size_t>(role)];
+    }
+    // Thread-safe submit. Roles that share a VkQueue share its lock;
+    // direct use of queue() (e.g. present) must stay on one thread.
+    void Submit(QueueRole role,
+        const vk::SubmitInfo2& submit_info,
+        vk::Fence fence = {});
 
    private:
+    static constexpr size_t kRoleCount = 3;
     void PickQueue(const vk::Device& device, size_t queue_family_index);
+    void PickRoleQueues(const vk::Device& device,
+        const QueueFamily& queue_family);
     vk::Queue queue_;
+    std::array<vk::Queue, kRoleCount> queues_;
+    // Index into mutexes_ per role, equal for roles on the same VkQueue
+    std::array<size_t, kRoleCount> lock_index_;
+    std::array<std::mutex, kRoleCount> mutexes_;
 };
 }  // namespace engine_init
 
-#endif
\ No newline at end of file
+#endif
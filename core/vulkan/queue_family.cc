@@ -2,12 +2,41 @@
 
 #include <vulkan/vulkan_core.h>
 
+#include <algorithm>
+
 namespace engine_init {
 
 QueueFamily::QueueFamily(const PhysicalDevice& physical_device,
     const Surface& surface) {
     PickQueueFamilyIndex(physical_device.physical_device(),
         surface.surface());
+    PickDedicatedFamilies(physical_device.physical_device());
+}
+
+uint32_t QueueFamily::family_index(QueueRole role) const {
+    switch (role) {
+        case QueueRole::kCompute:
+            return compute_family_index_;
+        case QueueRole::kTransfer:
+            return transfer_family_index_;
+        default:
+            return queue_family_index_;
+    }
+}
+
+std::vector<uint32_t> QueueFamily::unique_family_indices() const {
+    std::vector<uint32_t> indices{queue_family_index_};
+    const uint32_t dedicated[] = {
+        compute_family_index_,
+        transfer_family_index_,
+    };
+    for (uint32_t index : dedicated) {
+        if (std::find(indices.begin(), indices.end(), index) ==
+            indices.end()) {
+            indices.push_back(index);
+        }
+    }
+    return indices;
 }
 
 void QueueFamily::PickQueueFamilyIndex(
@@ -27,4 +56,32 @@ void QueueFamily::PickQueueFamilyIndex(
     }
 }
 
+void QueueFamily::PickDedicatedFamilies(
+    const vk::PhysicalDevice& physical_device) {
+    // Async compute: compute without graphics. Transfer: a copy-only
+    // family, usually the DMA engines. Both stay on the graphics family
+    // when the device has no such family.
+    compute_family_index_ = queue_family_index_;
+    transfer_family_index_ = queue_family_index_;
+    std::vector queue_families =
+        physical_device.getQueueFamilyProperties();
+    for (uint32_t i = 0; i < queue_families.size(); i++) {
+        if (i == queue_family_index_) {
+            continue;
+        }
+        const vk::QueueFlags flags = queue_families[i].queueFlags;
+        const bool graphics = !!(flags & vk::QueueFlagBits::eGraphics);
+        const bool compute = !!(flags & vk::QueueFlagBits::eCompute);
+        const bool transfer = !!(flags & vk::QueueFlagBits::eTransfer);
+        if (compute && !graphics &&
+            compute_family_index_ == queue_family_index_) {
+            compute_family_index_ = i;
+        }
+        if (transfer && !graphics && !compute &&
+            transfer_family_index_ == queue_family_index_) {
+            transfer_family_index_ = i;
+        }
+    }
+}
+
 }  // namespace engine_init
\ No newline at end of file
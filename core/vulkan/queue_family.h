@@ -3,6 +3,7 @@
 #define VK_INIT_QUEUE_FAMILY_H_
 
 #include <cstddef>
+#include <vector>
 #include <vulkan/vulkan.hpp>
 
 #include "physical_device.h"
@@ -10,6 +11,11 @@
 
 namespace engine_init {
 
+// What a queue is used for. Graphics is the compute + present family
+// everything ran on so far; compute and transfer map to dedicated
+// families when the device has them and fall back to graphics otherwise.
+enum class QueueRole { kGraphics, kCompute, kTransfer };
+
 struct QueueFamily {
    public:
     QueueFamily(const PhysicalDevice& physical_device,
@@ -18,12 +24,23 @@ struct QueueFamily {
     QueueFamily(const QueueFamily&) = delete;
     QueueFamily& operator=(const QueueFamily&) = delete;
     size_t queue_family_index() const { return queue_family_index_; }
+    uint32_t family_index(QueueRole role) const;
+    // True when `role` has a family of its own and can overlap with work
+    // on the graphics queue.
+    bool is_dedicated(QueueRole role) const {
+        return family_index(role) != queue_family_index_;
+    }
+    // One entry per distinct family, graphics first.
+    std::vector<uint32_t> unique_family_indices() const;
 
    private:
     void PickQueueFamilyIndex(const vk::PhysicalDevice& physical_device,
         const vk::SurfaceKHR& surface);
+    void PickDedicatedFamilies(const vk::PhysicalDevice& physical_device);
     uint32_t queue_family_index_;
+    uint32_t compute_family_index_;
+    uint32_t transfer_family_index_;
 };
 }  // namespace engine_init
 
-#endif
\ No newline at end of file
+#endif
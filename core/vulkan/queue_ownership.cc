@@ -0,0 +1,88 @@
+#include "queue_ownership.h"
+
+#include "vulkan/vulkan.hpp"
+
+namespace engine_init {
+
+// The release half has no destination scope and the acquire half no
+// source scope; the semaphore between the two queues orders them.
+
+void QueueOwnershipTransfer::Release(vk::CommandBuffer command_buffer,
+    vk::Buffer buffer) const {
+    if (same_family()) {
+        return;
+    }
+    vk::BufferMemoryBarrier2 barrier;
+    barrier.setSrcStageMask(src_stages);
+    barrier.setSrcAccessMask(src_access);
+    barrier.setSrcQueueFamilyIndex(src_family);
+    barrier.setDstQueueFamilyIndex(dst_family);
+    barrier.setBuffer(buffer);
+    barrier.setSize(VK_WHOLE_SIZE);
+    command_buffer.pipelineBarrier2(
+        vk::DependencyInfo().setBufferMemoryBarriers(barrier));
+}
+
+void QueueOwnershipTransfer::Acquire(vk::CommandBuffer command_buffer,
+    vk::Buffer buffer) const {
+    vk::BufferMemoryBarrier2 barrier;
+    if (same_family()) {
+        barrier.setSrcStageMask(src_stages);
+        barrier.setSrcAccessMask(src_access);
+    } else {
+        barrier.setSrcQueueFamilyIndex(src_family);
+        barrier.setDstQueueFamilyIndex(dst_family);
+    }
+    barrier.setDstStageMask(dst_stages);
+    barrier.setDstAccessMask(dst_access);
+    barrier.setBuffer(buffer);
+    barrier.setSize(VK_WHOLE_SIZE);
+    command_buffer.pipelineBarrier2(
+        vk::DependencyInfo().setBufferMemoryBarriers(barrier));
+}
+
+void QueueOwnershipTransfer::Release(vk::CommandBuffer command_buffer,
+    vk::Image image,
+    const vk::ImageSubresourceRange& range,
+    vk::ImageLayout old_layout,
+    vk::ImageLayout new_layout) const {
+    if (same_family()) {
+        return;
+    }
+    vk::ImageMemoryBarrier2 barrier;
+    barrier.setSrcStageMask(src_stages);
+    barrier.setSrcAccessMask(src_access);
+    barrier.setOldLayout(old_layout);
+    barrier.setNewLayout(new_layout);
+    barrier.setSrcQueueFamilyIndex(src_family);
+    barrier.setDstQueueFamilyIndex(dst_family);
+    barrier.setImage(image);
+    barrier.setSubresourceRange(range);
+    command_buffer.pipelineBarrier2(
+        vk::DependencyInfo().setImageMemoryBarriers(barrier));
+}
+
+void QueueOwnershipTransfer::Acquire(vk::CommandBuffer command_buffer,
+    vk::Image image,
+    const vk::ImageSubresourceRange& range,
+    vk::ImageLayout old_layout,
+    vk::ImageLayout new_layout) const {
+    vk::ImageMemoryBarrier2 barrier;
+    if (same_family()) {
+        barrier.setSrcStageMask(src_stages);
+        barrier.setSrcAccessMask(src_access);
+    } else {
+        barrier.setSrcQueueFamilyIndex(src_family);
+        barrier.setDstQueueFamilyIndex(dst_family);
+    }
+    barrier.setDstStageMask(dst_stages);
+    barrier.setDstAccessMask(dst_access);
+    barrier.setOldLayout(old_layout);
+    barrier.setNewLayout(new_layout);
+    barrier.setImage(image);
+    barrier.setSubresourceRange(range);
+    command_buffer.pipelineBarrier2(
+        vk::DependencyInfo().setImageMemoryBarriers(barrier));
+}
+
+}  // namespace engine_init
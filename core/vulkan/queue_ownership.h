@@ -0,0 +1,44 @@
+
+#ifndef VK_INIT_QUEUE_OWNERSHIP_H_
+#define VK_INIT_QUEUE_OWNERSHIP_H_
+
+#include <cstdint>
+#include <vulkan/vulkan.hpp>
+
+namespace engine_init {
+
+// Queue family ownership transfer of an exclusive resource, e.g. a
+// buffer filled on the transfer queue and read by the graphics queue.
+// Record Release() on the source queue and signal a timeline value,
+// then record Acquire() on the destination queue after waiting for it.
+// With both families equal the transfer degrades to the plain barrier
+// that Acquire() records, so single-queue devices need no special case.
+struct QueueOwnershipTransfer {
+    uint32_t src_family;
+    uint32_t dst_family;
+    vk::PipelineStageFlags2 src_stages;
+    vk::AccessFlags2 src_access;
+    vk::PipelineStageFlags2 dst_stages;
+    vk::AccessFlags2 dst_access;
+
+    bool same_family() const { return src_family == dst_family; }
+
+    void Release(vk::CommandBuffer command_buffer,
+        vk::Buffer buffer) const;
+    void Acquire(vk::CommandBuffer command_buffer,
+        vk::Buffer buffer) const;
+    // The layout transition is part of both halves and happens once.
+    void Release(vk::CommandBuffer command_buffer,
+        vk::Image image,
+        const vk::ImageSubresourceRange& range,
+        vk::ImageLayout old_layout,
+        vk::ImageLayout new_layout) const;
+    void Acquire(vk::CommandBuffer command_buffer,
+        vk::Image image,
+        const vk::ImageSubresourceRange& range,
+        vk::ImageLayout old_layout,
+        vk::ImageLayout new_layout) const;
+};
+}  // namespace engine_init
+
+#endif
@@ -1,10 +1,21 @@
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <deque>
 #include <fstream>
 #include <functional>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
 #include <iostream>
+#include <memory>
+#include <numbers>
+#include <optional>
+#include <random>
 #include <string>
+#include <unordered_map>
 #include <vulkan/vulkan.hpp>
 
 #define TINYOBJLOADER_IMPLEMENTATION
@@ -13,11 +24,97 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+#include "jobs/job_system.h"
+#include "vulkan/descriptor_allocator.h"
+#include "vulkan/frame_command_pools.h"
+#include "vulkan/queue_ownership.h"
+
 VULKAN_HPP_DEFAULT_DISPATCH_LOADER_DYNAMIC_STORAGE
 
 static constexpr int WIDTH = 1024;
 static constexpr int HEIGHT = 1024;
 
+// Window and swapchain size. WIDTH x HEIGHT is the render resolution;
+// the present pass scales it to the window when the two differ.
+static constexpr int kWindowWidth = 1024;
+static constexpr int kWindowHeight = 1024;
+
+// Closest hit copies a precomputed per-primitive record into the payload
+// instead of fetching three vertices to rebuild the face normal.
+static constexpr bool kUsePrimitiveInfo = true;
+// Count traced rays on the GPU for the rays/sec report. Each subgroup
+// adds its total with one atomic.
+static constexpr bool kCountRays = true;
+static constexpr int kStatsInterval = 60;
+
+// Must match SAMPLE_* in common.glsl
+enum class SamplingMode : uint32_t { Uniform, Cosine, Brdf };
+static constexpr SamplingMode kSamplingMode = SamplingMode::Cosine;
+// Bounces traced before Russian roulette may terminate a path
+static constexpr uint32_t kRussianRouletteDepth = 3;
+// Light candidates per pixel for ReSTIR's initial resampling
+static constexpr uint32_t kRestirCandidates = 32;
+// Equirectangular HDR sky; the constant sky is used when it is missing
+static constexpr const char* kEnvironmentPath = "./assets/environment.hdr";
+// Must match BLUE_NOISE_SIZE in sampler.glsl
+static constexpr uint32_t kBlueNoiseSize = 64;
+static constexpr uint32_t kSamplesPerLaunch = 32;
+// Samples per launch while the denoiser is on, for interactive preview
+static constexpr uint32_t kPreviewSamplesPerLaunch = 4;
+// A-trous iterations; the footprint doubles with each one
+static constexpr uint32_t kDenoiseIterations = 5;
+// Reprojected history is rejected where the hit distance differs by more
+// than this fraction, or the normals by more than this cosine.
+static constexpr float kReprojectDepthTolerance = 0.1f;
+static constexpr float kReprojectNormalTolerance = 0.9f;
+// History length, in samples, kept by pixels that moved on screen
+static constexpr float kMaxHistorySamples = 512.0f;
+// Camera speed in units and radians per second
+static constexpr float kCameraMoveSpeed = 2.0f;
+static constexpr float kCameraTurnSpeed = 1.0f;
+// Adaptive sampling stops tracing a pixel once the standard error of
+// its mean luminance falls below this fraction of the mean.
+static constexpr float kAdaptiveErrorThreshold = 0.02f;
+// Full-image launches before the variance estimate is trusted
+static constexpr int kAdaptiveWarmupFrames = 4;
+// Pixels reaching this many samples count as converged
+static constexpr uint32_t kAdaptiveMaxSamples = 16384;
+// Path segments per sample. Must match MAX_DEPTH in common.glsl.
+static constexpr uint32_t kMaxPathDepth = 8;
+// Must match MATERIAL_BINS in wavefront.glsl
+static constexpr uint32_t kMaterialBins = 16;
+// Headless batch: samples per view, and the orbit the views are spread
+// over, in radians around a point this far ahead of the default camera
+static constexpr uint32_t kBatchSamples = 1024;
+static constexpr float kBatchArc = 1.0f;
+static constexpr float kBatchOrbitRadius = 5.0f;
+// One-off commands recorded into a batch before it is submitted anyway
+static constexpr uint32_t kMaxBatchRecords = 64;
+// Dynamic resolution: GPU time the trace passes aim for while the camera
+// moves, and the smallest render scale it may drop to
+static constexpr double kTargetTraceMilliseconds = 8.0;
+static constexpr float kMinRenderScale = 0.5f;
+// Frames measured at one render size before it may change again
+static constexpr int kResolutionSettleFrames = 16;
+// Tiled tracing: tile side in pixels, and the GPU time the tiles of one
+// submission may take, well inside any driver watchdog
+static constexpr uint32_t kTraceTileSize = 128;
+static constexpr double kTileBudgetMilliseconds = 20.0;
+// Frames the host may record ahead of the GPU
+static constexpr uint32_t kFramesInFlight = 2;
+// Per-set descriptor mix of the passes; the compute passes are mostly
+// storage images. Pools grow past the initial size when a set misses.
+static constexpr uint32_t kInitialDescriptorSets = 16;
+static const std::vector<engine_init::DescriptorPoolRatio>
+    kDescriptorPoolRatios{
+        {vk::DescriptorType::eAccelerationStructureKHR, 0.25f},
+        {vk::DescriptorType::eStorageImage, 4.0f},
+        {vk::DescriptorType::eStorageBuffer, 1.0f},
+        {vk::DescriptorType::eUniformBuffer, 0.25f},
+    };
+
 struct Vertex {
     float position[3];
 };
@@ -27,9 +124,296 @@ struct Face {
     float emission[3];
 };
 
-void loadFromFile(std::vector<Vertex>& vertices,
-    std::vector<uint32_t>& indices,
-    std::vector<Face>& faces) {
+// Area light for next-event estimation, world space. Must match
+// EmissiveTriangle in common.glsl.
+struct EmissiveTriangle {
+    float p0[3];
+    float area;
+    float e1[3];
+    uint32_t emission;  // RGB9E5
+    float e2[3];
+    uint32_t normal;  // Octahedral
+};
+
+// Walker/Vose alias table entry: keep the sampled slot with
+// `probability`, otherwise take `alias`.
+struct AliasEntry {
+    float probability;
+    uint32_t alias;
+};
+
+// O(1) sampling of a discrete distribution proportional to `weights`.
+std::vector<AliasEntry> buildAliasTable(const std::vector<float>& weights) {
+    const size_t count = weights.size();
+    std::vector<AliasEntry> table(count);
+    double total = 0.0;
+    for (float weight : weights) {
+        total += weight;
+    }
+
+    std::vector<double> scaled(count);
+    std::vector<uint32_t> small;
+    std::vector<uint32_t> large;
+    for (uint32_t i = 0; i < count; i++) {
+        scaled[i] = total > 0.0 ? weights[i] * count / total : 1.0;
+        (scaled[i] < 1.0 ? small : large).push_back(i);
+    }
+    while (!small.empty() && !large.empty()) {
+        uint32_t less = small.back();
+        small.pop_back();
+        uint32_t more = large.back();
+        large.pop_back();
+        table[less] = {float(scaled[less]), more};
+        scaled[more] = (scaled[more] + scaled[less]) - 1.0;
+        (scaled[more] < 1.0 ? small : large).push_back(more);
+    }
+    // Leftovers are 1 up to rounding
+    for (uint32_t i : large) {
+        table[i] = {1.0f, i};
+    }
+    for (uint32_t i : small) {
+        table[i] = {1.0f, i};
+    }
+    return table;
+}
+
+// Sobol direction numbers (Joe & Kuo, new-joe-kuo-6.21201) for the
+// dimensions after the first: degree s, coefficients a, m_1..m_s. Paths
+// draw padded 2D samples, so only the first pair of dimensions is used.
+struct SobolPrimitive {
+    uint32_t degree;
+    uint32_t coefficients;
+    uint32_t m[7];
+};
+
+static constexpr SobolPrimitive kSobolPrimitives[] = {
+    {1, 0, {1}},
+};
+
+static constexpr uint32_t kSobolDimensions =
+    1 + sizeof(kSobolPrimitives) / sizeof(kSobolPrimitives[0]);
+static constexpr uint32_t kSobolBits = 32;
+
+// 32 direction numbers per dimension, MSB first. Must match
+// SOBOL_BITS in sampler.glsl.
+std::vector<uint32_t> buildSobolDirections() {
+    std::vector<uint32_t> directions(kSobolDimensions * kSobolBits);
+    for (uint32_t bit = 0; bit < kSobolBits; bit++) {
+        directions[bit] = 1u << (31 - bit);
+    }
+    for (uint32_t dim = 1; dim < kSobolDimensions; dim++) {
+        const SobolPrimitive& primitive = kSobolPrimitives[dim - 1];
+        uint32_t* v = directions.data() + dim * kSobolBits;
+        const uint32_t s = primitive.degree;
+        for (uint32_t i = 0; i < std::min(s, kSobolBits); i++) {
+            v[i] = primitive.m[i] << (31 - i);
+        }
+        for (uint32_t i = s; i < kSobolBits; i++) {
+            v[i] = v[i - s] ^ (v[i - s] >> s);
+            for (uint32_t k = 1; k < s; k++) {
+                if ((primitive.coefficients >> (s - 1 - k)) & 1) {
+                    v[i] ^= v[i - k];
+                }
+            }
+        }
+    }
+    return directions;
+}
+
+// Void-and-cluster blue noise (Ulichney 1993) on a torus. Returns ranks
+// normalized to [0, 1). Takes about 0.1 s for 64x64 in release builds.
+std::vector<float> buildBlueNoise(uint32_t size, uint32_t seed) {
+    const uint32_t count = size * size;
+    const float sigma = 1.9f;
+
+    // Toroidal Gaussian energy kernel, indexed by wrapped offset
+    std::vector<float> kernel(count);
+    for (uint32_t y = 0; y < size; y++) {
+        for (uint32_t x = 0; x < size; x++) {
+            float dx = float(std::min(x, size - x));
+            float dy = float(std::min(y, size - y));
+            kernel[y * size + x] =
+                std::exp(-(dx * dx + dy * dy) / (2.0f * sigma * sigma));
+        }
+    }
+
+    std::vector<uint8_t> pattern(count, 0);
+    std::vector<float> energy(count, 0.0f);
+    auto splat = [&](uint32_t p, float sign) {
+        const uint32_t px = p % size;
+        const uint32_t py = p / size;
+        for (uint32_t y = 0; y < size; y++) {
+            const uint32_t ky = (y + size - py) % size;
+            for (uint32_t x = 0; x < size; x++) {
+                const uint32_t kx = (x + size - px) % size;
+                energy[y * size + x] += sign * kernel[ky * size + kx];
+            }
+        }
+    };
+    auto tightestCluster = [&]() {
+        uint32_t best = 0;
+        float bestEnergy = -1.0f;
+        for (uint32_t i = 0; i < count; i++) {
+            if (pattern[i] && energy[i] > bestEnergy) {
+                bestEnergy = energy[i];
+                best = i;
+            }
+        }
+        return best;
+    };
+    auto largestVoid = [&]() {
+        uint32_t best = 0;
+        float bestEnergy = INFINITY;
+        for (uint32_t i = 0; i < count; i++) {
+            if (!pattern[i] && energy[i] < bestEnergy) {
+                bestEnergy = energy[i];
+                best = i;
+            }
+        }
+        return best;
+    };
+
+    // Initial pattern: random 10% of the pixels, then relaxed by moving
+    // the tightest cluster into the largest void until stable
+    std::mt19937 rng(seed);
+    const uint32_t initialOnes = count / 10;
+    uint32_t ones = 0;
+    while (ones < initialOnes) {
+        uint32_t p = rng() % count;
+        if (!pattern[p]) {
+            pattern[p] = 1;
+            splat(p, 1.0f);
+            ones++;
+        }
+    }
+    while (true) {
+        uint32_t cluster = tightestCluster();
+        pattern[cluster] = 0;
+        splat(cluster, -1.0f);
+        uint32_t gap = largestVoid();
+        pattern[gap] = 1;
+        splat(gap, 1.0f);
+        if (gap == cluster) {
+            break;
+        }
+    }
+
+    std::vector<uint32_t> ranks(count);
+    const std::vector<uint8_t> initialPattern = pattern;
+    const std::vector<float> initialEnergy = energy;
+
+    // Phase 1: rank the initial points by removing tightest clusters
+    for (uint32_t rank = ones; rank > 0; rank--) {
+        uint32_t cluster = tightestCluster();
+        pattern[cluster] = 0;
+        splat(cluster, -1.0f);
+        ranks[cluster] = rank - 1;
+    }
+
+    // Phase 2: fill the largest voids until every pixel is ranked
+    pattern = initialPattern;
+    energy = initialEnergy;
+    for (uint32_t rank = ones; rank < count; rank++) {
+        uint32_t gap = largestVoid();
+        pattern[gap] = 1;
+        splat(gap, 1.0f);
+        ranks[gap] = rank;
+    }
+
+    std::vector<float> noise(count);
+    for (uint32_t i = 0; i < count; i++) {
+        noise[i] = (ranks[i] + 0.5f) / count;
+    }
+    return noise;
+}
+// Packed per-primitive record: octahedral normal (snorm16x2), albedo
+// (unorm8x4, alpha = 1 marks a hit) and RGB9E5 emission. Must match
+// Primitives in common.glsl.
+struct PrimitiveInfo {
+    uint32_t normal;
+    uint32_t albedo;
+    uint32_t emission;
+};
+
+uint32_t packSnorm2x16(float x, float y) {
+    auto pack = [](float v) {
+        float clamped = std::clamp(v, -1.0f, 1.0f);
+        return static_cast<uint32_t>(
+                   static_cast<int16_t>(std::round(clamped * 32767.0f)))
+               & 0xFFFF;
+    };
+    return pack(x) | (pack(y) << 16);
+}
+
+uint32_t packOctahedralNormal(const float n[3]) {
+    float l1 = std::abs(n[0]) + std::abs(n[1]) + std::abs(n[2]);
+    float x = n[0] / l1;
+    float y = n[1] / l1;
+    if (n[2] < 0.0f) {
+        float ox = (1.0f - std::abs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        float oy = (1.0f - std::abs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = ox;
+        y = oy;
+    }
+    return packSnorm2x16(x, y);
+}
+
+uint32_t packUnorm4x8(float r, float g, float b, float a) {
+    auto pack = [](float v) {
+        return static_cast<uint32_t>(
+            std::round(std::clamp(v, 0.0f, 1.0f) * 255.0f));
+    };
+    return pack(r) | (pack(g) << 8) | (pack(b) << 16) | (pack(a) << 24);
+}
+
+// Shared-exponent HDR color, same layout as VK_FORMAT_E5B9G9R9.
+uint32_t packRGB9E5(const float c[3]) {
+    constexpr float maxValue = 65408.0f;
+    float r = std::clamp(c[0], 0.0f, maxValue);
+    float g = std::clamp(c[1], 0.0f, maxValue);
+    float b = std::clamp(c[2], 0.0f, maxValue);
+    float maxC = std::max({r, g, b, std::exp2(-16.0f)});
+    int exponent = std::max(-16, int(std::floor(std::log2(maxC)))) + 16;
+    float denom = std::exp2(float(exponent - 24));
+    if (int(std::floor(maxC / denom + 0.5f)) == 512) {
+        denom *= 2.0f;
+        exponent++;
+    }
+    auto mantissa = [&](float v) {
+        return static_cast<uint32_t>(std::floor(v / denom + 0.5f));
+    };
+    return mantissa(r) | (mantissa(g) << 9) | (mantissa(b) << 18)
+           | (static_cast<uint32_t>(exponent) << 27);
+}
+
+// Same as unpackRGB9E5 in common.glsl
+void unpackRGB9E5(uint32_t packed, float c[3]) {
+    float scale = std::exp2(float(int(packed >> 27) - 24));
+    c[0] = float(packed & 511u) * scale;
+    c[1] = float((packed >> 9) & 511u) * scale;
+    c[2] = float((packed >> 18) & 511u) * scale;
+}
+
+// One mesh per OBJ shape. Every mesh gets its own BLAS and TLAS instance,
+// so the hit shader finds its data through the per-instance record.
+struct MeshData {
+    std::vector<Vertex> vertices;
+    std::vector<uint32_t> indices;
+    std::vector<Face> faces;
+    std::vector<PrimitiveInfo> primitives;
+};
+
+// Per-instance record read by the hit shader through buffer references,
+// indexed by gl_InstanceCustomIndexEXT. Must match SceneInstance in
+// common.glsl.
+struct SceneInstance {
+    uint64_t vertexAddress;
+    uint64_t indexAddress;
+    uint64_t faceAddress;
+    uint64_t primitiveAddress;
+};
+
+void loadFromFile(std::vector<MeshData>& meshes) {
     tinyobj::attrib_t attrib;
     std::vector<tinyobj::shape_t> shapes;
     std::vector<tinyobj::material_t> materials;
@@ -46,6 +430,7 @@ void loadFromFile(std::vector<Vertex>& vertices,
     }
 
     for (const auto& shape : shapes) {
+        MeshData& mesh = meshes.emplace_back();
         for (const auto& index : shape.mesh.indices) {
             Vertex vertex{};
             vertex.position[0] =
@@ -54,8 +439,9 @@ void loadFromFile(std::vector<Vertex>& vertices,
                 -attrib.vertices[3 * index.vertex_index + 1];
             vertex.position[2] =
                 attrib.vertices[3 * index.vertex_index + 2];
-            vertices.push_back(vertex);
-            indices.push_back(static_cast<uint32_t>(indices.size()));
+            mesh.vertices.push_back(vertex);
+            mesh.indices.push_back(
+                static_cast<uint32_t>(mesh.indices.size()));
         }
         for (const auto& matIndex : shape.mesh.material_ids) {
             Face face;
@@ -65,7 +451,30 @@ void loadFromFile(std::vector<Vertex>& vertices,
             face.emission[0] = materials[matIndex].emission[0];
             face.emission[1] = materials[matIndex].emission[1];
             face.emission[2] = materials[matIndex].emission[2];
-            faces.push_back(face);
+            mesh.faces.push_back(face);
+        }
+
+        // Face normals are constant per triangle, so they are baked
+        // here with the material instead of per hit.
+        for (size_t i = 0; i < mesh.faces.size(); i++) {
+            const float* p0 = mesh.vertices[3 * i + 0].position;
+            const float* p1 = mesh.vertices[3 * i + 1].position;
+            const float* p2 = mesh.vertices[3 * i + 2].position;
+            float e01[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+            float e02[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+            float n[3] = {
+                -(e01[1] * e02[2] - e01[2] * e02[1]),
+                -(e01[2] * e02[0] - e01[0] * e02[2]),
+                -(e01[0] * e02[1] - e01[1] * e02[0]),
+            };
+            const Face& face = mesh.faces[i];
+            PrimitiveInfo& primitive = mesh.primitives.emplace_back();
+            primitive.normal = packOctahedralNormal(n);
+            primitive.albedo = packUnorm4x8(face.diffuse[0],
+                face.diffuse[1],
+                face.diffuse[2],
+                1.0f);
+            primitive.emission = packRGB9E5(face.emission);
         }
     }
 }
@@ -84,33 +493,404 @@ std::vector<char> readFile(const std::string& filename) {
     return buffer;
 }
 
+// Completion point of work recorded through Submitter. The zero ticket
+// is complete from the start.
+struct Ticket {
+    uint64_t value = 0;
+};
+
+// Resources retired while the GPU may still use them, freed in buckets
+// once the timeline passed the bucket's value. Counters track what is
+// still waiting and what was freed.
+struct DeletionQueue {
+    struct Bucket {
+        uint64_t value;
+        std::vector<std::shared_ptr<void>> objects;
+        vk::DeviceSize bytes = 0;
+    };
+
+    template <typename T>
+    void retire(Ticket ticket, T&& resource, vk::DeviceSize bytes = 0) {
+        if (buckets.empty() || buckets.back().value != ticket.value) {
+            buckets.push_back({ticket.value, {}, 0});
+        }
+        add(buckets.back(), std::forward<T>(resource), bytes);
+    }
+
+    // Frees every bucket the GPU is done with in one go
+    void collect(uint64_t completed) {
+        auto done = [&](const Bucket& bucket) {
+            if (bucket.value > completed) {
+                return false;
+            }
+            pendingObjects -= bucket.objects.size();
+            pendingBytes -= bucket.bytes;
+            freedObjects += bucket.objects.size();
+            freedBytes += bucket.bytes;
+            return true;
+        };
+        std::erase_if(buckets, done);
+    }
+
+    template <typename T>
+    void add(Bucket& bucket, T&& resource, vk::DeviceSize bytes) {
+        bucket.objects.push_back(
+            std::make_shared<std::decay_t<T>>(std::forward<T>(resource)));
+        bucket.bytes += bytes;
+        pendingObjects++;
+        pendingBytes += bytes;
+    }
+
+    std::vector<Bucket> buckets;
+    size_t pendingObjects = 0;
+    vk::DeviceSize pendingBytes = 0;
+    size_t freedObjects = 0;
+    vk::DeviceSize freedBytes = 0;
+};
+
+// One-off GPU work (layout transitions, AS builds, copies) batched into
+// pooled command buffers and ordered on a timeline semaphore, instead of
+// a fresh command buffer and a queue.waitIdle() per call. Records join
+// the open batch, which is submitted by flush(), when it fills up, or
+// when its ticket is waited on. Frames go through submitAfterUploads()
+// and wait for the uploads on the GPU, so the host only blocks when it
+// reads results back with wait(). Resources still in use go to
+// `deletions`. Single-threaded, like the rest of the prototype.
+//
+// Acceleration structure builds go through recordAsync() to an async
+// compute queue with a timeline of its own. What they hand over is
+// released there and acquired by the next main batch, which waits for
+// the async batch, so tickets always count on the main timeline.
+struct Submitter {
+    using Recorder = std::function<void(vk::CommandBuffer)>;
+
+    struct Batch {
+        vk::CommandBuffer commandBuffer;
+        uint64_t value;
+        uint32_t records;
+        // Async timeline value the batch waits for, 0 for none
+        uint64_t asyncValue;
+    };
+
+    // A queue with its own command pool, timeline and batches
+    struct Lane {
+        Lane(vk::Device device, vk::Queue queue, uint32_t family)
+            : queue{queue}, family{family} {
+            vk::CommandPoolCreateInfo commandPoolInfo;
+            commandPoolInfo.setFlags(
+                vk::CommandPoolCreateFlagBits::eResetCommandBuffer);
+            commandPoolInfo.setQueueFamilyIndex(family);
+            commandPool = device.createCommandPoolUnique(commandPoolInfo);
+
+            vk::SemaphoreTypeCreateInfo typeInfo;
+            typeInfo.setSemaphoreType(vk::SemaphoreType::eTimeline);
+            vk::SemaphoreCreateInfo semaphoreInfo;
+            semaphoreInfo.setPNext(&typeInfo);
+            semaphore = device.createSemaphoreUnique(semaphoreInfo);
+        }
+
+        vk::Queue queue;
+        uint32_t family;
+        vk::UniqueCommandPool commandPool;
+        vk::UniqueSemaphore semaphore;
+        uint64_t lastRecorded = 0;
+        uint64_t lastSubmitted = 0;
+        std::optional<Batch> openBatch;
+        std::deque<Batch> inFlight;
+        std::vector<vk::CommandBuffer> freeCommandBuffers;
+    };
+
+    // Without a separate async family, async records join the main
+    // batch and nothing changes hands
+    Submitter(vk::Device device,
+        vk::Queue queue,
+        uint32_t queueFamily,
+        vk::Queue asyncQueue,
+        uint32_t asyncQueueFamily)
+        : device{device}
+        , primary{device, queue, queueFamily}
+        , async{device, asyncQueue, asyncQueueFamily} {}
+
+    // Every async batch is waited on by a main batch, so the main
+    // timeline covers both queues
+    ~Submitter() {
+        if (primary.semaphore) {
+            wait({primary.lastSubmitted});
+        }
+    }
+
+    bool hasAsyncQueue() const { return async.family != primary.family; }
+
+    Ticket record(const Recorder& func) {
+        // Main queue work may read what async builds hand over, so
+        // their acquires go first
+        if (async.openBatch) {
+            flushAsync();
+        }
+        func(nextRecord(primary));
+        const Ticket ticket{primary.openBatch->value};
+        if (++primary.openBatch->records == kMaxBatchRecords) {
+            flush();
+        }
+        return ticket;
+    }
+
+    // Records on the async queue. `handOver` moves to the main queue
+    // when the async batch is flushed and must not be used on the async
+    // queue after that. The ticket is the main batch that acquires it.
+    Ticket recordAsync(const Recorder& func,
+        const std::vector<vk::Buffer>& handOver) {
+        if (!hasAsyncQueue()) {
+            return record(func);
+        }
+        func(nextRecord(async));
+        handOvers.insert(handOvers.end(),
+            handOver.begin(),
+            handOver.end());
+        beginBatch(primary);
+        const Ticket ticket{primary.openBatch->value};
+        if (++async.openBatch->records == kMaxBatchRecords) {
+            flushAsync();
+        }
+        return ticket;
+    }
+
+    // Submits the open batch after the previous one. Returns the ticket
+    // of everything recorded so far.
+    Ticket flush() {
+        flushAsync();
+        collect();
+        if (primary.openBatch) {
+            submitBatch(primary);
+        }
+        return {primary.lastSubmitted};
+    }
+
+    // Submits the async batch with the releases of what it hands over,
+    // and records the matching acquires into the main batch, which
+    // waits for the async batch on the GPU
+    void flushAsync() {
+        if (!async.openBatch) {
+            return;
+        }
+        const engine_init::QueueOwnershipTransfer transfer =
+            handOverTransfer();
+        for (vk::Buffer buffer : handOvers) {
+            transfer.Release(async.openBatch->commandBuffer, buffer);
+        }
+        submitBatch(async);
+        const vk::CommandBuffer commandBuffer = beginBatch(primary);
+        for (vk::Buffer buffer : handOvers) {
+            transfer.Acquire(commandBuffer, buffer);
+        }
+        handOvers.clear();
+        primary.openBatch->asyncValue = async.lastSubmitted;
+    }
+
+    bool isComplete(Ticket ticket) const {
+        return ticket.value
+               <= device.getSemaphoreCounterValue(*primary.semaphore);
+    }
+
+    void wait(Ticket ticket) {
+        if (ticket.value > primary.lastSubmitted) {
+            flush();
+        }
+        if (!isComplete(ticket)) {
+            vk::SemaphoreWaitInfo waitInfo;
+            waitInfo.setSemaphores(*primary.semaphore);
+            waitInfo.setValues(ticket.value);
+            if (device.waitSemaphores(waitInfo, UINT64_MAX)
+                != vk::Result::eSuccess) {
+                throw std::runtime_error("failed to wait for upload!");
+            }
+        }
+        collect();
+    }
+
+    // Submits frame work behind every upload recorded before it, after
+    // `acquired` and signalling `rendered` when given. The frame gets
+    // its own timeline value.
+    Ticket submitAfterUploads(vk::CommandBuffer commandBuffer,
+        vk::Semaphore acquired = {},
+        vk::Semaphore rendered = {}) {
+        flush();
+        const Ticket frame{++primary.lastRecorded};
+        submit(primary, commandBuffer, frame.value, 0, acquired, rendered);
+        return frame;
+    }
+
+    // Recycles the command buffers of completed batches and frees what
+    // was retired before them
+    void collect() {
+        for (Lane* lane : {&primary, &async}) {
+            const uint64_t completed =
+                device.getSemaphoreCounterValue(*lane->semaphore);
+            while (!lane->inFlight.empty()
+                   && lane->inFlight.front().value <= completed) {
+                lane->freeCommandBuffers.push_back(
+                    lane->inFlight.front().commandBuffer);
+                lane->inFlight.pop_front();
+            }
+        }
+        deletions.collect(
+            device.getSemaphoreCounterValue(*primary.semaphore));
+    }
+
+    // Acceleration structures built on the async queue and the geometry
+    // they were built from, read by shaders and later builds
+    engine_init::QueueOwnershipTransfer handOverTransfer() const {
+        return {async.family,
+            primary.family,
+            vk::PipelineStageFlagBits2::eAccelerationStructureBuildKHR,
+            vk::AccessFlagBits2::eAccelerationStructureWriteKHR,
+            vk::PipelineStageFlagBits2::eRayTracingShaderKHR
+                | vk::PipelineStageFlagBits2::eComputeShader
+                | vk::PipelineStageFlagBits2::
+                    eAccelerationStructureBuildKHR,
+            vk::AccessFlagBits2::eAccelerationStructureReadKHR
+                | vk::AccessFlagBits2::eShaderStorageRead};
+    }
+
+    vk::CommandBuffer acquireCommandBuffer(Lane& lane) {
+        if (!lane.freeCommandBuffers.empty()) {
+            vk::CommandBuffer commandBuffer =
+                lane.freeCommandBuffers.back();
+            lane.freeCommandBuffers.pop_back();
+            return commandBuffer;
+        }
+        vk::CommandBufferAllocateInfo commandBufferInfo;
+        commandBufferInfo.setCommandPool(*lane.commandPool);
+        commandBufferInfo.setCommandBufferCount(1);
+        return device.allocateCommandBuffers(commandBufferInfo).front();
+    }
+
+    // Opens a batch on `lane` unless one is open
+    vk::CommandBuffer beginBatch(Lane& lane) {
+        if (!lane.openBatch) {
+            lane.openBatch = Batch{acquireCommandBuffer(lane),
+                ++lane.lastRecorded,
+                0,
+                0};
+            lane.openBatch->commandBuffer.begin(
+                {vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+        }
+        return lane.openBatch->commandBuffer;
+    }
+
+    // The open batch of `lane`, ordered after what it already holds
+    vk::CommandBuffer nextRecord(Lane& lane) {
+        if (!lane.openBatch) {
+            return beginBatch(lane);
+        }
+        // Records used to be separated by a queue drain; keep them
+        // ordered, e.g. a TLAS build after its BLAS builds
+        vk::MemoryBarrier barrier;
+        barrier.setSrcAccessMask(vk::AccessFlagBits::eMemoryWrite);
+        barrier.setDstAccessMask(vk::AccessFlagBits::eMemoryRead
+                                 | vk::AccessFlagBits::eMemoryWrite);
+        lane.openBatch->commandBuffer.pipelineBarrier(
+            vk::PipelineStageFlagBits::eAllCommands,
+            vk::PipelineStageFlagBits::eAllCommands,
+            {},
+            barrier,
+            {},
+            {});
+        return lane.openBatch->commandBuffer;
+    }
+
+    void submitBatch(Lane& lane) {
+        Batch& batch = *lane.openBatch;
+        batch.commandBuffer.end();
+        submit(lane, batch.commandBuffer, batch.value, batch.asyncValue);
+        lane.inFlight.push_back(batch);
+        lane.openBatch.reset();
+    }
+
+    // Batches wait for their predecessor, so each timeline completes in
+    // order and one value covers all earlier work on it. Binary
+    // semaphores ride along with a value the driver ignores.
+    void submit(Lane& lane,
+        vk::CommandBuffer commandBuffer,
+        uint64_t value,
+        uint64_t asyncValue,
+        vk::Semaphore acquired = {},
+        vk::Semaphore rendered = {}) {
+        std::vector<vk::Semaphore> waitSemaphores{*lane.semaphore};
+        std::vector<uint64_t> waitValues{lane.lastSubmitted};
+        std::vector<vk::Semaphore> signalSemaphores{*lane.semaphore};
+        std::vector<uint64_t> signalValues{value};
+        if (asyncValue) {
+            waitSemaphores.push_back(*async.semaphore);
+            waitValues.push_back(asyncValue);
+        }
+        if (acquired) {
+            waitSemaphores.push_back(acquired);
+            waitValues.push_back(0);
+        }
+        if (rendered) {
+            signalSemaphores.push_back(rendered);
+            signalValues.push_back(0);
+        }
+        const std::vector<vk::PipelineStageFlags> waitStages(
+            waitSemaphores.size(),
+            vk::PipelineStageFlagBits::eAllCommands);
+        vk::TimelineSemaphoreSubmitInfo timelineInfo;
+        timelineInfo.setWaitSemaphoreValues(waitValues);
+        timelineInfo.setSignalSemaphoreValues(signalValues);
+        vk::SubmitInfo submitInfo;
+        submitInfo.setCommandBuffers(commandBuffer);
+        submitInfo.setWaitSemaphores(waitSemaphores);
+        submitInfo.setWaitDstStageMask(waitStages);
+        submitInfo.setSignalSemaphores(signalSemaphores);
+        submitInfo.setPNext(&timelineInfo);
+        lane.queue.submit(submitInfo);
+        lane.lastSubmitted = value;
+    }
+
+    vk::Device device;
+    Lane primary;
+    Lane async;
+    std::vector<vk::Buffer> handOvers;
+    DeletionQueue deletions;
+};
+
 struct Context {
-    Context() {
-        int width, height, channels;
-        unsigned char* pixels =
-            stbi_load("assets/ICON.png", &width, &height, &channels, 4);
-
-        GLFWimage image;
-        image.height = height;
-        image.width = width;
-        image.pixels = pixels;
-
-        glfwInit();
-        glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-        glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
-        window = glfwCreateWindow(WIDTH,
-            HEIGHT,
-            "Mighty Engine",
-            nullptr,
-            nullptr);
-        glfwSetWindowIcon(window, 1, &image);
+    // Headless runs get no window, surface or swapchain extension, and
+    // take any compute queue family
+    explicit Context(bool headless = false) {
+        std::vector<const char*> extensions;
+        if (!headless) {
+            int width, height, channels;
+            unsigned char* pixels = stbi_load("assets/ICON.png",
+                &width,
+                &height,
+                &channels,
+                4);
+
+            GLFWimage image;
+            image.height = height;
+            image.width = width;
+            image.pixels = pixels;
+
+            glfwInit();
+            glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+            glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
+            window = glfwCreateWindow(kWindowWidth,
+                kWindowHeight,
+                "Mighty Engine",
+                nullptr,
+                nullptr);
+            glfwSetWindowIcon(window, 1, &image);
+
+            uint32_t glfwExtensionCount = 0;
+            const char** glfwExtensions =
+                glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+            extensions.assign(glfwExtensions,
+                glfwExtensions + glfwExtensionCount);
+        }
 
         // Prepase extensions and layers
-        uint32_t glfwExtensionCount = 0;
-        const char** glfwExtensions =
-            glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
-        std::vector extensions(glfwExtensions,
-            glfwExtensions + glfwExtensionCount);
         extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
 
         std::vector layers{"VK_LAYER_KHRONOS_validation"};
@@ -145,16 +925,19 @@ struct Context {
             instance->createDebugUtilsMessengerEXTUnique(messengerInfo);
 
         // Create surface
-        VkSurfaceKHR _surface;
-        VkResult res = glfwCreateWindowSurface(VkInstance(*instance),
-            window,
-            nullptr,
-            &_surface);
-        if (res != VK_SUCCESS) {
-            throw std::runtime_error("failed to create window surface!");
+        if (!headless) {
+            VkSurfaceKHR _surface;
+            VkResult res = glfwCreateWindowSurface(VkInstance(*instance),
+                window,
+                nullptr,
+                &_surface);
+            if (res != VK_SUCCESS) {
+                throw std::runtime_error(
+                    "failed to create window surface!");
+            }
+            surface = vk::UniqueSurfaceKHR(vk::SurfaceKHR(_surface),
+                {*instance});
         }
-        surface =
-            vk::UniqueSurfaceKHR(vk::SurfaceKHR(_surface), {*instance});
 
         // Find queue family
         std::vector queueFamilies =
@@ -163,20 +946,40 @@ struct Context {
             auto supportCompute =
                 queueFamilies[i].queueFlags & vk::QueueFlagBits::eCompute;
             auto supportPresent =
-                physicalDevice.getSurfaceSupportKHR(i, *surface);
+                headless
+                || physicalDevice.getSurfaceSupportKHR(i, *surface);
             if (supportCompute && supportPresent) {
                 queueFamilyIndex = i;
             }
         }
 
+        // Acceleration structure builds go to a compute family without
+        // graphics when there is one, and share the queue otherwise
+        asyncQueueFamilyIndex = queueFamilyIndex;
+        for (uint32_t i = 0; i < queueFamilies.size(); i++) {
+            const vk::QueueFlags flags = queueFamilies[i].queueFlags;
+            if (i != queueFamilyIndex
+                && (flags & vk::QueueFlagBits::eCompute)
+                && !(flags & vk::QueueFlagBits::eGraphics)) {
+                asyncQueueFamilyIndex = i;
+                break;
+            }
+        }
+
         // Create device
         const float queuePriority = 1.0f;
-        vk::DeviceQueueCreateInfo queueCreateInfo;
-        queueCreateInfo.setQueueFamilyIndex(queueFamilyIndex);
-        queueCreateInfo.setQueuePriorities(queuePriority);
+        std::vector<vk::DeviceQueueCreateInfo> queueCreateInfos;
+        for (uint32_t family : {queueFamilyIndex, asyncQueueFamilyIndex}) {
+            if (queueCreateInfos.empty()
+                || family != queueCreateInfos.front().queueFamilyIndex) {
+                vk::DeviceQueueCreateInfo& queueCreateInfo =
+                    queueCreateInfos.emplace_back();
+                queueCreateInfo.setQueueFamilyIndex(family);
+                queueCreateInfo.setQueuePriorities(queuePriority);
+            }
+        }
 
-        const std::vector deviceExtensions{
-            VK_KHR_SWAPCHAIN_EXTENSION_NAME,
+        std::vector deviceExtensions{
             VK_KHR_DEDICATED_ALLOCATION_EXTENSION_NAME,
             VK_KHR_GET_MEMORY_REQUIREMENTS_2_EXTENSION_NAME,
             VK_KHR_MAINTENANCE3_EXTENSION_NAME,
@@ -185,7 +988,11 @@ struct Context {
             VK_KHR_BUFFER_DEVICE_ADDRESS_EXTENSION_NAME,
             VK_KHR_RAY_TRACING_PIPELINE_EXTENSION_NAME,
             VK_KHR_ACCELERATION_STRUCTURE_EXTENSION_NAME,
+            VK_KHR_RAY_QUERY_EXTENSION_NAME,
         };
+        if (!headless) {
+            deviceExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+        }
 
         if (!checkDeviceExtensionSupport(deviceExtensions)) {
             throw std::runtime_error(
@@ -193,20 +1000,30 @@ struct Context {
         }
 
         vk::DeviceCreateInfo deviceInfo;
-        deviceInfo.setQueueCreateInfos(queueCreateInfo);
+        deviceInfo.setQueueCreateInfos(queueCreateInfos);
         deviceInfo.setPEnabledExtensionNames(deviceExtensions);
 
         vk::PhysicalDeviceBufferDeviceAddressFeatures
             bufferDeviceAddressFeatures{true};
         vk::PhysicalDeviceRayTracingPipelineFeaturesKHR
             rayTracingPipelineFeatures{true};
+        rayTracingPipelineFeatures.setRayTracingPipelineTraceRaysIndirect(
+            true);
         vk::PhysicalDeviceAccelerationStructureFeaturesKHR
             accelerationStructureFeatures{true};
+        vk::PhysicalDeviceRayQueryFeaturesKHR rayQueryFeatures{true};
+        vk::PhysicalDeviceTimelineSemaphoreFeatures
+            timelineSemaphoreFeatures{true};
+        vk::PhysicalDeviceSynchronization2Features
+            synchronization2Features{true};
         vk::StructureChain createInfoChain{
             deviceInfo,
             bufferDeviceAddressFeatures,
+            timelineSemaphoreFeatures,
+            synchronization2Features,
             rayTracingPipelineFeatures,
             accelerationStructureFeatures,
+            rayQueryFeatures,
         };
 
         device = physicalDevice.createDeviceUnique(
@@ -214,6 +1031,7 @@ struct Context {
         VULKAN_HPP_DEFAULT_DISPATCHER.init(*device);
 
         queue = device->getQueue(queueFamilyIndex, 0);
+        asyncQueue = device->getQueue(asyncQueueFamilyIndex, 0);
 
         // Create command pool
         vk::CommandPoolCreateInfo commandPoolInfo;
@@ -222,19 +1040,15 @@ struct Context {
         commandPoolInfo.setQueueFamilyIndex(queueFamilyIndex);
         commandPool = device->createCommandPoolUnique(commandPoolInfo);
 
-        // Create descriptor pool
-        std::vector<vk::DescriptorPoolSize> poolSizes{
-            {vk::DescriptorType::eAccelerationStructureKHR, 1},
-            {vk::DescriptorType::eStorageImage, 1},
-            {vk::DescriptorType::eStorageBuffer, 3},
-        };
-
-        vk::DescriptorPoolCreateInfo descPoolInfo;
-        descPoolInfo.setPoolSizes(poolSizes);
-        descPoolInfo.setMaxSets(1);
-        descPoolInfo.setFlags(
-            vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet);
-        descPool = device->createDescriptorPoolUnique(descPoolInfo);
+        submitter = std::make_unique<Submitter>(*device,
+            queue,
+            queueFamilyIndex,
+            asyncQueue,
+            asyncQueueFamilyIndex);
+        descriptors = std::make_unique<engine_init::DescriptorAllocator>(
+            *device,
+            kInitialDescriptorSets,
+            kDescriptorPoolRatios);
     }
 
     bool checkDeviceExtensionSupport(
@@ -285,33 +1099,25 @@ struct Context {
         throw std::runtime_error("failed to find suitable memory type");
     }
 
-    void oneTimeSubmit(
+    // Records one-off work into the submitter's open batch without
+    // waiting for it. Wait on the ticket before reading results back.
+    Ticket submit(
         const std::function<void(vk::CommandBuffer)>& func) const {
-        vk::CommandBufferAllocateInfo commandBufferInfo;
-        commandBufferInfo.setCommandPool(*commandPool);
-        commandBufferInfo.setCommandBufferCount(1);
-
-        vk::UniqueCommandBuffer commandBuffer = std::move(
-            device->allocateCommandBuffersUnique(commandBufferInfo)
-                .front());
-        commandBuffer->begin(
-            {vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
-        func(*commandBuffer);
-        commandBuffer->end();
+        return submitter->record(func);
+    }
 
-        vk::SubmitInfo submitInfo;
-        submitInfo.setCommandBuffers(*commandBuffer);
-        queue.submit(submitInfo);
-        queue.waitIdle();
+    // Like submit(), on the async compute queue. `handOver` is read by
+    // the main queue afterwards; see Submitter::recordAsync().
+    Ticket submitAsync(const std::function<void(vk::CommandBuffer)>& func,
+        const std::vector<vk::Buffer>& handOver) const {
+        return submitter->recordAsync(func, handOver);
     }
 
-    vk::UniqueDescriptorSet allocateDescSet(
+    // Sets live until the allocator is destroyed, so the resolve sets of
+    // every swapchain image just grow the pool chain.
+    vk::DescriptorSet allocateDescSet(
         vk::DescriptorSetLayout descSetLayout) {
-        vk::DescriptorSetAllocateInfo descSetInfo;
-        descSetInfo.setDescriptorPool(*descPool);
-        descSetInfo.setSetLayouts(descSetLayout);
-        return std::move(
-            device->allocateDescriptorSetsUnique(descSetInfo).front());
+        return descriptors->Allocate(descSetLayout);
     }
 
     static VKAPI_ATTR vk::Bool32 VKAPI_CALL debugUtilsMessengerCallback(
@@ -323,7 +1129,7 @@ struct Context {
         return VK_FALSE;
     }
 
-    GLFWwindow* window;
+    GLFWwindow* window = nullptr;
     vk::detail::DynamicLoader dl;
     vk::UniqueInstance instance;
     vk::UniqueDebugUtilsMessengerEXT messenger;
@@ -332,8 +1138,13 @@ struct Context {
     vk::PhysicalDevice physicalDevice;
     uint32_t queueFamilyIndex;
     vk::Queue queue;
+    // Same as the main family and queue on devices without async compute
+    uint32_t asyncQueueFamilyIndex;
+    vk::Queue asyncQueue;
     vk::UniqueCommandPool commandPool;
-    vk::UniqueDescriptorPool descPool;
+    // Declared after the device so it is destroyed, and drained, first
+    std::unique_ptr<Submitter> submitter;
+    std::unique_ptr<engine_init::DescriptorAllocator> descriptors;
 };
 
 struct Buffer {
@@ -342,6 +1153,11 @@ struct Buffer {
         AccelInput,
         AccelStorage,
         ShaderBindingTable,
+        Storage,
+        Indirect,
+        Uniform,
+        DeviceStorage,
+        Readback,
     };
 
     Buffer() = default;
@@ -368,6 +1184,30 @@ struct Buffer {
             usage = Usage::eShaderBindingTableKHR
                     | Usage::eShaderDeviceAddress;
             memoryProps = Memory::eHostVisible | Memory::eHostCoherent;
+        } else if (type == Type::Storage) {
+            usage = Usage::eStorageBuffer | Usage::eShaderDeviceAddress
+                    | Usage::eTransferSrc | Usage::eTransferDst;
+            memoryProps = Memory::eHostVisible | Memory::eHostCoherent;
+        } else if (type == Type::Indirect) {
+            // Written by compute, consumed by indirect launches and
+            // copied back for the host
+            usage = Usage::eIndirectBuffer | Usage::eStorageBuffer
+                    | Usage::eShaderDeviceAddress | Usage::eTransferSrc
+                    | Usage::eTransferDst;
+            memoryProps = Memory::eHostVisible | Memory::eHostCoherent;
+        } else if (type == Type::Uniform) {
+            // Updated in the command stream while frames are in flight
+            usage = Usage::eUniformBuffer | Usage::eShaderDeviceAddress
+                    | Usage::eTransferDst;
+            memoryProps = Memory::eHostVisible | Memory::eHostCoherent;
+        } else if (type == Type::DeviceStorage) {
+            // Produced and consumed on the GPU only
+            usage = Usage::eStorageBuffer | Usage::eShaderDeviceAddress;
+            memoryProps = Memory::eDeviceLocal;
+        } else if (type == Type::Readback) {
+            // Target of image copies, mapped on the host
+            usage = Usage::eTransferDst | Usage::eShaderDeviceAddress;
+            memoryProps = Memory::eHostVisible | Memory::eHostCoherent;
         }
 
         buffer = context.device->createBufferUnique({{}, size, usage});
@@ -414,19 +1254,15 @@ struct Buffer {
 
 struct Image {
     Image() = default;
+    // More than one layer, or `array`, makes a 2D array view
     Image(const Context& context,
         vk::Extent2D extent,
         vk::Format format,
-        vk::ImageUsageFlags usage) {
-        // Create image
-        vk::ImageCreateInfo imageInfo;
-        imageInfo.setImageType(vk::ImageType::e2D);
-        imageInfo.setExtent({extent.width, extent.height, 1});
-        imageInfo.setMipLevels(1);
-        imageInfo.setArrayLayers(1);
-        imageInfo.setFormat(format);
-        imageInfo.setUsage(usage);
-        image = context.device->createImageUnique(imageInfo);
+        vk::ImageUsageFlags usage,
+        uint32_t layers = 1,
+        bool array = false) {
+        create(context, extent, format, usage, layers);
+        arrayView = array || layers > 1;
 
         // Allocate memory
         vk::MemoryRequirements requirements =
@@ -439,27 +1275,62 @@ struct Image {
         memoryInfo.setMemoryTypeIndex(memoryTypeIndex);
         memory = context.device->allocateMemoryUnique(memoryInfo);
 
-        // Bind memory and image
-        context.device->bindImageMemory(*image, *memory, 0);
+        bind(context, *memory, 0);
+        context.submit([&](vk::CommandBuffer commandBuffer) {  //
+            setImageLayout(commandBuffer,
+                *image,
+                vk::ImageLayout::eUndefined,
+                vk::ImageLayout::eGeneral);
+        });
+    }
+
+    // Image without memory of its own, bound later into memory it
+    // shares with other render graph transients. It has no view and
+    // no layout until then.
+    static Image transient(const Context& context,
+        vk::Extent2D extent,
+        vk::Format format,
+        vk::ImageUsageFlags usage) {
+        Image transientImage;
+        transientImage.create(context, extent, format, usage, 1);
+        return transientImage;
+    }
+
+    void create(const Context& context,
+        vk::Extent2D extent,
+        vk::Format imageFormat,
+        vk::ImageUsageFlags usage,
+        uint32_t imageLayers) {
+        vk::ImageCreateInfo imageInfo;
+        imageInfo.setImageType(vk::ImageType::e2D);
+        imageInfo.setExtent({extent.width, extent.height, 1});
+        imageInfo.setMipLevels(1);
+        imageInfo.setArrayLayers(imageLayers);
+        imageInfo.setFormat(imageFormat);
+        imageInfo.setUsage(usage);
+        image = context.device->createImageUnique(imageInfo);
+        format = imageFormat;
+        layers = imageLayers;
+    }
+
+    // Binds the image at `offset` and creates its view
+    void bind(const Context& context,
+        vk::DeviceMemory deviceMemory,
+        vk::DeviceSize offset) {
+        context.device->bindImageMemory(*image, deviceMemory, offset);
 
-        // Create image view
         vk::ImageViewCreateInfo imageViewInfo;
         imageViewInfo.setImage(*image);
-        imageViewInfo.setViewType(vk::ImageViewType::e2D);
+        imageViewInfo.setViewType(arrayView ? vk::ImageViewType::e2DArray
+                                            : vk::ImageViewType::e2D);
         imageViewInfo.setFormat(format);
         imageViewInfo.setSubresourceRange(
-            {vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1});
+            {vk::ImageAspectFlagBits::eColor, 0, 1, 0, layers});
         view = context.device->createImageViewUnique(imageViewInfo);
 
         // Set image info
         descImageInfo.setImageView(*view);
         descImageInfo.setImageLayout(vk::ImageLayout::eGeneral);
-        context.oneTimeSubmit([&](vk::CommandBuffer commandBuffer) {  //
-            setImageLayout(commandBuffer,
-                *image,
-                vk::ImageLayout::eUndefined,
-                vk::ImageLayout::eGeneral);
-        });
     }
 
     static vk::AccessFlags toAccessFlags(vk::ImageLayout layout) {
@@ -483,8 +1354,11 @@ struct Image {
         barrier.setImage(image);
         barrier.setOldLayout(oldLayout);
         barrier.setNewLayout(newLayout);
-        barrier.setSubresourceRange(
-            {vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1});
+        barrier.setSubresourceRange({vk::ImageAspectFlagBits::eColor,
+            0,
+            1,
+            0,
+            VK_REMAINING_ARRAY_LAYERS});
         barrier.setSrcAccessMask(toAccessFlags(oldLayout));
         barrier.setDstAccessMask(toAccessFlags(newLayout));
         commandBuffer.pipelineBarrier(
@@ -498,7 +1372,9 @@ struct Image {
 
     static void copyImage(vk::CommandBuffer commandBuffer,
         vk::Image srcImage,
-        vk::Image dstImage) {
+        vk::Image dstImage,
+        vk::ImageLayout srcLayout = vk::ImageLayout::eTransferSrcOptimal,
+        vk::ImageLayout dstLayout = vk::ImageLayout::eTransferDstOptimal) {
         vk::ImageCopy copyRegion;
         copyRegion.setSrcSubresource(
             {vk::ImageAspectFlagBits::eColor, 0, 0, 1});
@@ -506,24 +1382,60 @@ struct Image {
             {vk::ImageAspectFlagBits::eColor, 0, 0, 1});
         copyRegion.setExtent({WIDTH, HEIGHT, 1});
         commandBuffer.copyImage(srcImage,
+            srcLayout,
+            dstImage,
+            dstLayout,
+            copyRegion);
+    }
+
+    // Filtered copy between images of different sizes
+    static void blitImage(vk::CommandBuffer commandBuffer,
+        vk::Image srcImage,
+        vk::Extent2D srcExtent,
+        vk::Image dstImage,
+        vk::Extent2D dstExtent) {
+        vk::ImageBlit blitRegion;
+        blitRegion.setSrcSubresource(
+            {vk::ImageAspectFlagBits::eColor, 0, 0, 1});
+        blitRegion.setDstSubresource(
+            {vk::ImageAspectFlagBits::eColor, 0, 0, 1});
+        blitRegion.setSrcOffsets({vk::Offset3D{0, 0, 0},
+            vk::Offset3D{static_cast<int32_t>(srcExtent.width),
+                static_cast<int32_t>(srcExtent.height),
+                1}});
+        blitRegion.setDstOffsets({vk::Offset3D{0, 0, 0},
+            vk::Offset3D{static_cast<int32_t>(dstExtent.width),
+                static_cast<int32_t>(dstExtent.height),
+                1}});
+        commandBuffer.blitImage(srcImage,
             vk::ImageLayout::eTransferSrcOptimal,
             dstImage,
             vk::ImageLayout::eTransferDstOptimal,
-            copyRegion);
+            blitRegion,
+            vk::Filter::eLinear);
     }
 
     vk::UniqueImage image;
     vk::UniqueImageView view;
+    // Empty for transients, whose memory the render graph owns
     vk::UniqueDeviceMemory memory;
     vk::DescriptorImageInfo descImageInfo;
+    vk::Format format = vk::Format::eUndefined;
+    uint32_t layers = 1;
+    bool arrayView = false;
 };
 
+// Built on the async compute queue. `inputs` are the buffers the build
+// reads that the main queue uses later: the geometry of a bottom level,
+// the bottom levels of a top level. Bottom levels stay with the async
+// queue until the top level over them hands them over with itself.
 struct Accel {
     Accel() = default;
     Accel(const Context& context,
         vk::AccelerationStructureGeometryKHR geometry,
         uint32_t primitiveCount,
-        vk::AccelerationStructureTypeKHR type) {
+        vk::AccelerationStructureTypeKHR type,
+        std::vector<vk::Buffer> inputs = {}) {
         vk::AccelerationStructureBuildGeometryInfoKHR buildGeometryInfo;
         buildGeometryInfo.setType(type);
         buildGeometryInfo.setFlags(
@@ -554,15 +1466,24 @@ struct Accel {
         buildGeometryInfo.setScratchData(scratchBuffer.deviceAddress);
         buildGeometryInfo.setDstAccelerationStructure(*accel);
 
-        context.oneTimeSubmit([&](vk::CommandBuffer commandBuffer) {  //
-            vk::AccelerationStructureBuildRangeInfoKHR buildRangeInfo;
-            buildRangeInfo.setPrimitiveCount(primitiveCount);
-            buildRangeInfo.setFirstVertex(0);
-            buildRangeInfo.setPrimitiveOffset(0);
-            buildRangeInfo.setTransformOffset(0);
-            commandBuffer.buildAccelerationStructuresKHR(buildGeometryInfo,
-                &buildRangeInfo);
-        });
+        if (type == vk::AccelerationStructureTypeKHR::eTopLevel) {
+            inputs.push_back(*buffer.buffer);
+        }
+        const Ticket built = context.submitAsync(
+            [&](vk::CommandBuffer commandBuffer) {
+                vk::AccelerationStructureBuildRangeInfoKHR buildRangeInfo;
+                buildRangeInfo.setPrimitiveCount(primitiveCount);
+                buildRangeInfo.setFirstVertex(0);
+                buildRangeInfo.setPrimitiveOffset(0);
+                buildRangeInfo.setTransformOffset(0);
+                commandBuffer.buildAccelerationStructuresKHR(
+                    buildGeometryInfo,
+                    &buildRangeInfo);
+            },
+            inputs);
+        context.submitter->deletions.retire(built,
+            std::move(scratchBuffer),
+            buildSizesInfo.buildScratchSize);
 
         descAccelInfo.setAccelerationStructures(*accel);
     }
@@ -572,101 +1493,1592 @@ struct Accel {
     vk::WriteDescriptorSetAccelerationStructureKHR descAccelInfo;
 };
 
-int run() {
-    Context context;
-
-    vk::SwapchainCreateInfoKHR swapchainInfo;
-    swapchainInfo.setSurface(*context.surface);
-    swapchainInfo.setMinImageCount(3);
-    swapchainInfo.setImageFormat(vk::Format::eB8G8R8A8Unorm);
-    swapchainInfo.setImageColorSpace(vk::ColorSpaceKHR::eSrgbNonlinear);
-    swapchainInfo.setImageExtent({WIDTH, HEIGHT});
-    swapchainInfo.setImageArrayLayers(1);
-    swapchainInfo.setImageUsage(vk::ImageUsageFlagBits::eTransferDst);
-    swapchainInfo.setPreTransform(
-        vk::SurfaceTransformFlagBitsKHR::eIdentity);
-    swapchainInfo.setPresentMode(vk::PresentModeKHR::eFifo);
-    swapchainInfo.setClipped(true);
-    swapchainInfo.setQueueFamilyIndices(context.queueFamilyIndex);
-    vk::UniqueSwapchainKHR swapchain =
-        context.device->createSwapchainKHRUnique(swapchainInfo);
-
-    std::vector<vk::Image> swapchainImages =
-        context.device->getSwapchainImagesKHR(*swapchain);
-
-    vk::CommandBufferAllocateInfo commandBufferInfo;
-    commandBufferInfo.setCommandPool(*context.commandPool);
-    commandBufferInfo.setCommandBufferCount(
-        static_cast<uint32_t>(swapchainImages.size()));
-    std::vector<vk::UniqueCommandBuffer> commandBuffers =
-        context.device->allocateCommandBuffersUnique(commandBufferInfo);
-
-    Image outputImage{context,
-        {WIDTH, HEIGHT},
-        vk::Format::eB8G8R8A8Unorm,
-        vk::ImageUsageFlagBits::eStorage
-            | vk::ImageUsageFlagBits::eTransferSrc
-            | vk::ImageUsageFlagBits::eTransferDst};
+// Timestamp pairs around GPU passes. Each frame in flight has its own
+// timer, read once the timeline passed the slot's frame, so results are
+// read back without waiting on the query pool.
+struct GpuTimer {
+    GpuTimer() = default;
+    GpuTimer(const Context& context, uint32_t passCount)
+        : passCount(passCount) {
+        vk::QueryPoolCreateInfo queryPoolInfo;
+        queryPoolInfo.setQueryType(vk::QueryType::eTimestamp);
+        queryPoolInfo.setQueryCount(passCount * 2);
+        queryPool = context.device->createQueryPoolUnique(queryPoolInfo);
+        timestampPeriod = context.physicalDevice.getProperties()
+                              .limits.timestampPeriod;
+    }
 
-    // Load mesh
-    std::vector<Vertex> vertices;
-    std::vector<uint32_t> indices;
-    std::vector<Face> faces;
-    loadFromFile(vertices, indices, faces);
+    void reset(vk::CommandBuffer commandBuffer) const {
+        commandBuffer.resetQueryPool(*queryPool, 0, passCount * 2);
+    }
 
-    Buffer vertexBuffer{context,
-        Buffer::Type::AccelInput,
-        sizeof(Vertex) * vertices.size(),
-        vertices.data()};
-    Buffer indexBuffer{context,
-        Buffer::Type::AccelInput,
-        sizeof(uint32_t) * indices.size(),
-        indices.data()};
-    Buffer faceBuffer{context,
-        Buffer::Type::AccelInput,
-        sizeof(Face) * faces.size(),
-        faces.data()};
-
-    // Create bottom level accel struct
-    vk::AccelerationStructureGeometryTrianglesDataKHR triangleData;
-    triangleData.setVertexFormat(vk::Format::eR32G32B32Sfloat);
-    triangleData.setVertexData(vertexBuffer.deviceAddress);
-    triangleData.setVertexStride(sizeof(Vertex));
-    triangleData.setMaxVertex(static_cast<uint32_t>(vertices.size()));
-    triangleData.setIndexType(vk::IndexType::eUint32);
-    triangleData.setIndexData(indexBuffer.deviceAddress);
-
-    vk::AccelerationStructureGeometryKHR triangleGeometry;
-    triangleGeometry.setGeometryType(vk::GeometryTypeKHR::eTriangles);
-    triangleGeometry.setGeometry({triangleData});
-    triangleGeometry.setFlags(vk::GeometryFlagBitsKHR::eOpaque);
-
-    const auto primitiveCount = static_cast<uint32_t>(indices.size() / 3);
-
-    Accel bottomAccel{context,
-        triangleGeometry,
-        primitiveCount,
-        vk::AccelerationStructureTypeKHR::eBottomLevel};
+    void begin(vk::CommandBuffer commandBuffer, uint32_t pass) const {
+        commandBuffer.writeTimestamp(
+            vk::PipelineStageFlagBits::eTopOfPipe,
+            *queryPool,
+            pass * 2);
+    }
 
-    // Create top level accel struct
-    vk::TransformMatrixKHR transformMatrix = std::array{
-        std::array{1.0f, 0.0f, 0.0f, 0.0f},
-        std::array{0.0f, 1.0f, 0.0f, 0.0f},
-        std::array{0.0f, 0.0f, 1.0f, 0.0f},
-    };
+    void end(vk::CommandBuffer commandBuffer, uint32_t pass) const {
+        commandBuffer.writeTimestamp(
+            vk::PipelineStageFlagBits::eBottomOfPipe,
+            *queryPool,
+            pass * 2 + 1);
+    }
 
-    vk::AccelerationStructureInstanceKHR accelInstance;
-    accelInstance.setTransform(transformMatrix);
-    accelInstance.setMask(0xFF);
-    accelInstance.setAccelerationStructureReference(
-        bottomAccel.buffer.deviceAddress);
-    accelInstance.setFlags(
-        vk::GeometryInstanceFlagBitsKHR::eTriangleFacingCullDisable);
+    std::vector<double> readMilliseconds(const Context& context) const {
+        std::vector<uint64_t> timestamps(passCount * 2);
+        vk::Result result = context.device->getQueryPoolResults(
+            *queryPool,
+            0,
+            passCount * 2,
+            timestamps.size() * sizeof(uint64_t),
+            timestamps.data(),
+            sizeof(uint64_t),
+            vk::QueryResultFlagBits::e64);
+        std::vector<double> milliseconds(passCount, 0.0);
+        if (result != vk::Result::eSuccess) {
+            return milliseconds;
+        }
+        for (uint32_t i = 0; i < passCount; i++) {
+            milliseconds[i] = double(timestamps[i * 2 + 1]
+                                     - timestamps[i * 2])
+                              * timestampPeriod * 1e-6;
+        }
+        return milliseconds;
+    }
+
+    vk::UniqueQueryPool queryPool;
+    uint32_t passCount = 0;
+    float timestampPeriod = 1.0f;
+};
+
+// Compute pipeline with a single descriptor set and an optional push
+// constant block, shared by the post-trace passes.
+struct ComputePass {
+    ComputePass() = default;
+    ComputePass(const Context& context,
+        const std::string& shaderPath,
+        const std::vector<vk::DescriptorSetLayoutBinding>& bindings,
+        uint32_t pushConstantSize = 0,
+        const vk::SpecializationInfo* specialization = nullptr) {
+        const std::vector<char> code = readFile(shaderPath);
+        vk::UniqueShaderModule shaderModule =
+            context.device->createShaderModuleUnique({{},
+                code.size(),
+                reinterpret_cast<const uint32_t*>(code.data())});
+
+        vk::DescriptorSetLayoutCreateInfo descSetLayoutInfo;
+        descSetLayoutInfo.setBindings(bindings);
+        descSetLayout = context.device->createDescriptorSetLayoutUnique(
+            descSetLayoutInfo);
+
+        vk::PushConstantRange pushRange;
+        pushRange.setOffset(0);
+        pushRange.setSize(pushConstantSize);
+        pushRange.setStageFlags(vk::ShaderStageFlagBits::eCompute);
+
+        vk::PipelineLayoutCreateInfo pipelineLayoutInfo;
+        pipelineLayoutInfo.setSetLayouts(*descSetLayout);
+        if (pushConstantSize > 0) {
+            pipelineLayoutInfo.setPushConstantRanges(pushRange);
+        }
+        pipelineLayout =
+            context.device->createPipelineLayoutUnique(pipelineLayoutInfo);
+
+        vk::ComputePipelineCreateInfo pipelineInfo;
+        pipelineInfo.setStage({{},
+            vk::ShaderStageFlagBits::eCompute,
+            *shaderModule,
+            "main",
+            specialization});
+        pipelineInfo.setLayout(*pipelineLayout);
+        auto result =
+            context.device->createComputePipelineUnique(nullptr,
+                pipelineInfo);
+        if (result.result != vk::Result::eSuccess) {
+            throw std::runtime_error("failed to create compute pipeline.");
+        }
+        pipeline = std::move(result.value);
+    }
+
+    void dispatch(vk::CommandBuffer commandBuffer,
+        vk::DescriptorSet descSet,
+        uint32_t width,
+        uint32_t height,
+        const void* pushData = nullptr,
+        uint32_t pushSize = 0) const {
+        commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+            *pipeline);
+        commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute,
+            *pipelineLayout,
+            0,
+            descSet,
+            nullptr);
+        if (pushData) {
+            commandBuffer.pushConstants(*pipelineLayout,
+                vk::ShaderStageFlagBits::eCompute,
+                0,
+                pushSize,
+                pushData);
+        }
+        // Shaders use 8x8 work groups
+        commandBuffer.dispatch((width + 7) / 8, (height + 7) / 8, 1);
+    }
+
+    // Group counts come from `argsBuffer` at `offset`, written on the GPU
+    void dispatchIndirect(vk::CommandBuffer commandBuffer,
+        vk::DescriptorSet descSet,
+        vk::Buffer argsBuffer,
+        vk::DeviceSize offset,
+        const void* pushData = nullptr,
+        uint32_t pushSize = 0) const {
+        commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+            *pipeline);
+        commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute,
+            *pipelineLayout,
+            0,
+            descSet,
+            nullptr);
+        if (pushData) {
+            commandBuffer.pushConstants(*pipelineLayout,
+                vk::ShaderStageFlagBits::eCompute,
+                0,
+                pushSize,
+                pushData);
+        }
+        commandBuffer.dispatchIndirect(argsBuffer, offset);
+    }
+
+    vk::UniqueDescriptorSetLayout descSetLayout;
+    vk::UniquePipelineLayout pipelineLayout;
+    vk::UniquePipeline pipeline;
+};
+
+// Makes writes of one stage visible to reads of the next. Storage images
+// stay in eGeneral, so no layout transition is needed.
+void memoryBarrier(vk::CommandBuffer commandBuffer,
+    vk::PipelineStageFlags srcStage,
+    vk::PipelineStageFlags dstStage,
+    vk::AccessFlags dstAccess = vk::AccessFlagBits::eShaderRead
+                                | vk::AccessFlagBits::eShaderWrite,
+    vk::AccessFlags srcAccess = vk::AccessFlagBits::eShaderWrite) {
+    vk::MemoryBarrier barrier;
+    barrier.setSrcAccessMask(srcAccess);
+    barrier.setDstAccessMask(dstAccess);
+    commandBuffer.pipelineBarrier(srcStage, dstStage, {}, barrier, {}, {});
+}
+
+// Last use of every image and buffer declared to it, so a new use gets
+// exactly the barrier it needs: none for reads that already see the
+// last write, an execution-only dependency for writes after reads, and
+// layout transitions that wait on the real producer instead of
+// eAllCommands. Barriers queue up until flush() emits them in one
+// vkCmdPipelineBarrier2; uses of the same resource with no commands in
+// between merge into one barrier, so transitions such as the copy
+// source going back to eGeneral fold into its next use.
+struct BarrierTracker {
+    struct State {
+        vk::ImageLayout layout = vk::ImageLayout::eUndefined;
+        // Last write or layout transition, and the reads since then
+        vk::PipelineStageFlags2 writeStages;
+        vk::AccessFlags2 writeAccess;
+        vk::PipelineStageFlags2 readStages;
+        vk::AccessFlags2 readAccess;
+    };
+
+    static constexpr vk::AccessFlags2 kWriteAccess =
+        vk::AccessFlagBits2::eShaderWrite
+        | vk::AccessFlagBits2::eShaderStorageWrite
+        | vk::AccessFlagBits2::eColorAttachmentWrite
+        | vk::AccessFlagBits2::eTransferWrite
+        | vk::AccessFlagBits2::eHostWrite
+        | vk::AccessFlagBits2::eMemoryWrite
+        | vk::AccessFlagBits2::eAccelerationStructureWriteKHR;
+
+    // The following commands use `image` in `layout`
+    void use(vk::Image image,
+        vk::ImageLayout layout,
+        vk::PipelineStageFlags2 stages,
+        vk::AccessFlags2 access) {
+        State& state = images[image];
+        const bool transition = layout != state.layout;
+        vk::PipelineStageFlags2 srcStages;
+        vk::AccessFlags2 srcAccess;
+        if (hazard(state,
+                transition,
+                stages,
+                access,
+                srcStages,
+                srcAccess)) {
+            auto pending = pendingImages.find(image);
+            if (pending != pendingImages.end()) {
+                vk::ImageMemoryBarrier2& barrier =
+                    imageBarriers[pending->second];
+                barrier.setNewLayout(layout);
+                barrier.dstStageMask |= stages;
+                barrier.dstAccessMask |= access;
+            } else {
+                vk::ImageMemoryBarrier2 barrier;
+                barrier.setSrcStageMask(srcStages);
+                barrier.setSrcAccessMask(srcAccess);
+                barrier.setDstStageMask(stages);
+                barrier.setDstAccessMask(access);
+                barrier.setOldLayout(state.layout);
+                barrier.setNewLayout(layout);
+                barrier.setImage(image);
+                barrier.setSubresourceRange(
+                    {vk::ImageAspectFlagBits::eColor,
+                        0,
+                        1,
+                        0,
+                        VK_REMAINING_ARRAY_LAYERS});
+                pendingImages[image] = imageBarriers.size();
+                imageBarriers.push_back(barrier);
+            }
+        }
+        record(state, transition, stages, access);
+        state.layout = layout;
+    }
+
+    void use(vk::Buffer buffer,
+        vk::PipelineStageFlags2 stages,
+        vk::AccessFlags2 access) {
+        State& state = buffers[buffer];
+        vk::PipelineStageFlags2 srcStages;
+        vk::AccessFlags2 srcAccess;
+        if (hazard(state, false, stages, access, srcStages, srcAccess)) {
+            auto pending = pendingBuffers.find(buffer);
+            if (pending != pendingBuffers.end()) {
+                vk::BufferMemoryBarrier2& barrier =
+                    bufferBarriers[pending->second];
+                barrier.dstStageMask |= stages;
+                barrier.dstAccessMask |= access;
+            } else {
+                vk::BufferMemoryBarrier2 barrier;
+                barrier.setSrcStageMask(srcStages);
+                barrier.setSrcAccessMask(srcAccess);
+                barrier.setDstStageMask(stages);
+                barrier.setDstAccessMask(access);
+                barrier.setBuffer(buffer);
+                barrier.setSize(VK_WHOLE_SIZE);
+                pendingBuffers[buffer] = bufferBarriers.size();
+                bufferBarriers.push_back(barrier);
+            }
+        }
+        record(state, false, stages, access);
+    }
+
+    // Contents are not needed by the next use, e.g. a swapchain image
+    // coming back from the presentation engine
+    void discard(vk::Image image) {
+        images[image].layout = vk::ImageLayout::eUndefined;
+    }
+
+    // Forget the history of an image that was synchronized elsewhere
+    void assume(vk::Image image, vk::ImageLayout layout) {
+        images[image] = State{layout};
+    }
+
+    // `image` takes over memory `previous` used: its contents are gone
+    // and its next use waits for everything done to either of them
+    void alias(vk::Image previous, vk::Image image) {
+        const State last = images[previous];
+        State& state = images[image];
+        state.layout = vk::ImageLayout::eUndefined;
+        state.writeStages |= state.readStages | last.writeStages
+                             | last.readStages;
+        state.writeAccess |= last.writeAccess;
+        state.readStages = {};
+        state.readAccess = {};
+    }
+
+    // Queued barriers, to be recorded later, possibly on another thread
+    struct Barriers {
+        std::vector<vk::ImageMemoryBarrier2> images;
+        std::vector<vk::BufferMemoryBarrier2> buffers;
+
+        void record(vk::CommandBuffer commandBuffer) const {
+            if (images.empty() && buffers.empty()) {
+                return;
+            }
+            vk::DependencyInfo dependencyInfo;
+            dependencyInfo.setImageMemoryBarriers(images);
+            dependencyInfo.setBufferMemoryBarriers(buffers);
+            commandBuffer.pipelineBarrier2(dependencyInfo);
+        }
+    };
+
+    Barriers take() {
+        barrierCount += imageBarriers.size() + bufferBarriers.size();
+        Barriers barriers{std::move(imageBarriers),
+            std::move(bufferBarriers)};
+        imageBarriers.clear();
+        bufferBarriers.clear();
+        pendingImages.clear();
+        pendingBuffers.clear();
+        return barriers;
+    }
+
+    void flush(vk::CommandBuffer commandBuffer) {
+        take().record(commandBuffer);
+    }
+
+    // Source scope a use has to wait for. A layout transition counts as
+    // a write.
+    static bool hazard(const State& state,
+        bool transition,
+        vk::PipelineStageFlags2 stages,
+        vk::AccessFlags2 access,
+        vk::PipelineStageFlags2& srcStages,
+        vk::AccessFlags2& srcAccess) {
+        if (transition || (access & kWriteAccess)) {
+            srcStages = state.writeStages | state.readStages;
+            srcAccess = state.writeAccess;
+            return transition || srcStages;
+        }
+        const bool seen = (state.readStages & stages) == stages
+                          && (state.readAccess & access) == access;
+        if (!state.writeStages || seen) {
+            return false;
+        }
+        srcStages = state.writeStages;
+        srcAccess = state.writeAccess;
+        return true;
+    }
+
+    static void record(State& state,
+        bool transition,
+        vk::PipelineStageFlags2 stages,
+        vk::AccessFlags2 access) {
+        if (transition || (access & kWriteAccess)) {
+            state.writeStages = stages;
+            state.writeAccess = access & kWriteAccess;
+            // A transition to a read layout also counts as those reads
+            state.readStages = {};
+            state.readAccess = {};
+            if (transition) {
+                state.readStages = stages;
+                state.readAccess = access & ~kWriteAccess;
+            }
+        } else {
+            state.readStages |= stages;
+            state.readAccess |= access;
+        }
+    }
+
+    std::unordered_map<VkImage, State> images;
+    std::unordered_map<VkBuffer, State> buffers;
+    std::vector<vk::ImageMemoryBarrier2> imageBarriers;
+    std::vector<vk::BufferMemoryBarrier2> bufferBarriers;
+    std::unordered_map<VkImage, size_t> pendingImages;
+    std::unordered_map<VkBuffer, size_t> pendingBuffers;
+    // Barriers emitted so far, for the stats line
+    uint64_t barrierCount = 0;
+};
+
+// The frame as passes that declare every image and buffer they touch.
+// compile() orders the passes from those declarations, drops passes
+// whose results nothing uses and places transient images with disjoint
+// lifetimes in the same memory. execute() records the enabled passes in
+// that order; passes are switched on and off from frame to frame, so the
+// barriers between them come from the tracker, out of what actually ran.
+//
+// There is no queue assignment: every pass records into the frame's one
+// command buffer on the main queue. The passes of a frame are close to
+// a single chain, each reading what the one before it wrote, so moving
+// some to the async compute queue would mostly buy a semaphore wait and
+// an ownership transfer of the images in between. The async queue takes
+// the acceleration structure builds instead (Submitter::recordAsync()).
+struct RenderGraph {
+    using ResourceId = uint32_t;
+    using PassId = uint32_t;
+    static constexpr uint32_t kNone = ~0u;
+
+    struct Use {
+        ResourceId resource;
+        vk::ImageLayout layout;
+        vk::PipelineStageFlags2 stages;
+        vk::AccessFlags2 access;
+    };
+
+    struct Pass {
+        std::string name;
+        std::vector<Use> uses;
+        std::function<void(vk::CommandBuffer)> record;
+        // GpuTimer slot, written even while the pass is disabled so the
+        // query pool stays readable
+        uint32_t timer = kNone;
+        bool enabled = true;
+        // Passes whose uses must come first, and whether any output of
+        // this one is used
+        std::vector<PassId> dependencies;
+        bool culled = false;
+    };
+
+    struct Resource {
+        std::string name;
+        vk::Image image;
+        vk::Buffer buffer;
+        // Layout before the first pass, for imported images
+        vk::ImageLayout initialLayout = vk::ImageLayout::eUndefined;
+        // Contents do not survive from one frame to the next: transients
+        // and imports such as the swapchain image
+        bool discard = false;
+        std::unique_ptr<Image> transient;
+        // Lifetime in execution order, and the transient placed in the
+        // same memory right before this one
+        uint32_t first = kNone;
+        uint32_t last = kNone;
+        ResourceId previousAlias = kNone;
+        bool touched = false;
+    };
+
+    // Persistent image, left in `layout` by whoever created it
+    ResourceId importImage(const std::string& name,
+        vk::Image image,
+        vk::ImageLayout layout,
+        bool discard = false) {
+        Resource& resource = resources.emplace_back();
+        resource.name = name;
+        resource.image = image;
+        resource.initialLayout = layout;
+        resource.discard = discard;
+        tracker.assume(image, layout);
+        return static_cast<ResourceId>(resources.size() - 1);
+    }
+
+    ResourceId importBuffer(const std::string& name, vk::Buffer buffer) {
+        Resource& resource = resources.emplace_back();
+        resource.name = name;
+        resource.buffer = buffer;
+        return static_cast<ResourceId>(resources.size() - 1);
+    }
+
+    // Image that lives within a frame. Its view exists after compile().
+    ResourceId createImage(const Context& context,
+        const std::string& name,
+        vk::Extent2D extent,
+        vk::Format format,
+        vk::ImageUsageFlags usage) {
+        Resource& resource = resources.emplace_back();
+        resource.name = name;
+        resource.discard = true;
+        resource.transient = std::make_unique<Image>(
+            Image::transient(context, extent, format, usage));
+        resource.image = *resource.transient->image;
+        return static_cast<ResourceId>(resources.size() - 1);
+    }
+
+    // Swaps an imported image, such as this frame's swapchain image
+    void setImage(ResourceId id, vk::Image image) {
+        resources[id].image = image;
+    }
+
+    const Image& image(ResourceId id) const {
+        return *resources[id].transient;
+    }
+
+    PassId addPass(const std::string& name, uint32_t timer = kNone) {
+        Pass& pass = passes.emplace_back();
+        pass.name = name;
+        pass.timer = timer;
+        return static_cast<PassId>(passes.size() - 1);
+    }
+
+    // Buffers ignore the layout
+    void use(PassId pass,
+        ResourceId resource,
+        vk::PipelineStageFlags2 stages,
+        vk::AccessFlags2 access,
+        vk::ImageLayout layout = vk::ImageLayout::eGeneral) {
+        passes[pass].uses.push_back({resource, layout, stages, access});
+    }
+
+    void compile(const Context& context) {
+        // A use depends on the last write to its resource, a write also
+        // on every read since then. Layout transitions count as writes.
+        std::vector<PassId> lastWriter(resources.size(), kNone);
+        std::vector<std::vector<PassId>> readers(resources.size());
+        std::vector<vk::ImageLayout> layouts(resources.size());
+        for (ResourceId id = 0; id < resources.size(); id++) {
+            layouts[id] = resources[id].initialLayout;
+        }
+        auto dependOn = [](Pass& pass, PassId id, PassId dependency) {
+            if (dependency != kNone && dependency != id) {
+                pass.dependencies.push_back(dependency);
+            }
+        };
+        for (PassId id = 0; id < passes.size(); id++) {
+            Pass& pass = passes[id];
+            for (const Use& use : pass.uses) {
+                const ResourceId resource = use.resource;
+                const bool transition = !resources[resource].buffer
+                                        && use.layout != layouts[resource];
+                dependOn(pass, id, lastWriter[resource]);
+                if (!transition
+                    && !(use.access & BarrierTracker::kWriteAccess)) {
+                    readers[resource].push_back(id);
+                    continue;
+                }
+                for (PassId reader : readers[resource]) {
+                    dependOn(pass, id, reader);
+                }
+                readers[resource].clear();
+                lastWriter[resource] = id;
+                layouts[resource] = use.layout;
+            }
+        }
+
+        // Keep passes that leave the last write to an imported resource
+        // behind, and everything they depend on. Dependencies always
+        // point back, so one backwards walk finds them all.
+        for (Pass& pass : passes) {
+            pass.culled = true;
+        }
+        for (PassId id = static_cast<PassId>(passes.size()); id-- > 0;) {
+            Pass& pass = passes[id];
+            for (const Use& use : pass.uses) {
+                if (lastWriter[use.resource] == id
+                    && !resources[use.resource].transient) {
+                    pass.culled = false;
+                }
+            }
+            if (pass.culled) {
+                continue;
+            }
+            for (PassId dependency : pass.dependencies) {
+                passes[dependency].culled = false;
+            }
+        }
+
+        // Of the passes whose dependencies are recorded, take the one
+        // whose inputs were finished the longest ago, so a producer and
+        // its consumer end up apart and the barrier between them waits
+        // on less. Ties keep declaration order.
+        std::vector<uint32_t> position(passes.size(), kNone);
+        order.clear();
+        while (true) {
+            PassId best = kNone;
+            int bestLatest = 0;
+            for (PassId id = 0; id < passes.size(); id++) {
+                if (passes[id].culled || position[id] != kNone) {
+                    continue;
+                }
+                int latest = -1;
+                bool ready = true;
+                for (PassId dependency : passes[id].dependencies) {
+                    ready &= position[dependency] != kNone;
+                    latest = std::max(latest,
+                        static_cast<int>(position[dependency]));
+                }
+                if (ready && (best == kNone || latest < bestLatest)) {
+                    best = id;
+                    bestLatest = latest;
+                }
+            }
+            if (best == kNone) {
+                break;
+            }
+            position[best] = static_cast<uint32_t>(order.size());
+            order.push_back(best);
+        }
+
+        // Lifetimes of the transients in that order
+        for (PassId id : order) {
+            for (const Use& use : passes[id].uses) {
+                Resource& resource = resources[use.resource];
+                if (!resource.transient) {
+                    continue;
+                }
+                if (resource.first == kNone
+                    && !(use.access & BarrierTracker::kWriteAccess)) {
+                    throw std::runtime_error("render graph reads "
+                                             + resource.name
+                                             + " before writing it.");
+                }
+                if (resource.first == kNone) {
+                    resource.first = position[id];
+                }
+                resource.last = position[id];
+            }
+        }
+
+        // Largest first, each transient goes into the first block of
+        // memory none of whose images are alive at the same time
+        struct Block {
+            vk::MemoryRequirements requirements;
+            std::vector<ResourceId> resources;
+        };
+        std::vector<ResourceId> transients;
+        std::vector<vk::MemoryRequirements> requirements(resources.size());
+        for (ResourceId id = 0; id < resources.size(); id++) {
+            if (resources[id].transient) {
+                requirements[id] =
+                    context.device->getImageMemoryRequirements(
+                        resources[id].image);
+                transients.push_back(id);
+                transientBytes += requirements[id].size;
+            }
+        }
+        std::stable_sort(transients.begin(),
+            transients.end(),
+            [&](ResourceId a, ResourceId b) {
+                return requirements[a].size > requirements[b].size;
+            });
+        auto overlaps = [&](ResourceId a, ResourceId b) {
+            const Resource& x = resources[a];
+            const Resource& y = resources[b];
+            return x.first != kNone && y.first != kNone
+                   && x.first <= y.last && y.first <= x.last;
+        };
+        std::vector<Block> blocks;
+        for (ResourceId id : transients) {
+            Block* target = nullptr;
+            for (Block& block : blocks) {
+                bool fits = block.requirements.memoryTypeBits
+                            & requirements[id].memoryTypeBits;
+                for (ResourceId other : block.resources) {
+                    fits &= !overlaps(id, other);
+                }
+                if (fits) {
+                    target = &block;
+                    break;
+                }
+            }
+            if (!target) {
+                target = &blocks.emplace_back();
+                target->requirements = requirements[id];
+            }
+            vk::MemoryRequirements& blockRequirements =
+                target->requirements;
+            blockRequirements.size =
+                std::max(blockRequirements.size, requirements[id].size);
+            blockRequirements.alignment =
+                std::max(blockRequirements.alignment,
+                    requirements[id].alignment);
+            blockRequirements.memoryTypeBits &=
+                requirements[id].memoryTypeBits;
+            target->resources.push_back(id);
+        }
+
+        for (Block& block : blocks) {
+            vk::MemoryAllocateInfo memoryInfo;
+            memoryInfo.setAllocationSize(block.requirements.size);
+            memoryInfo.setMemoryTypeIndex(
+                context.findMemoryType(block.requirements.memoryTypeBits,
+                    vk::MemoryPropertyFlagBits::eDeviceLocal));
+            vk::UniqueDeviceMemory& blockMemory =
+                memory.emplace_back(
+                    context.device->allocateMemoryUnique(memoryInfo));
+            aliasedBytes += block.requirements.size;
+
+            // Every image starts where the one before it in the frame
+            // left off, the first one after last frame's last one
+            std::sort(block.resources.begin(),
+                block.resources.end(),
+                [&](ResourceId a, ResourceId b) {
+                    return resources[a].first < resources[b].first;
+                });
+            const size_t count = block.resources.size();
+            for (size_t i = 0; i < count; i++) {
+                Resource& resource = resources[block.resources[i]];
+                resource.transient->bind(context, *blockMemory, 0);
+                if (count > 1) {
+                    resource.previousAlias =
+                        block.resources[(i + count - 1) % count];
+                }
+            }
+        }
+
+        std::cout << "Render graph:";
+        for (PassId id : order) {
+            std::cout << " " << passes[id].name;
+        }
+        std::cout << "; "
+                  << passes.size() - order.size() << " culled, "
+                  << transientBytes / (1 << 20) << " MiB of transients in "
+                  << aliasedBytes / (1 << 20) << " MiB" << std::endl;
+    }
+
+    // The barriers of every pass are worked out here, in order. With a
+    // job system the passes are then recorded into secondaries across
+    // its threads and executed in order from `commandBuffer`, so the
+    // bodies must not write state another pass reads.
+    void execute(vk::CommandBuffer commandBuffer,
+        const GpuTimer& timer,
+        engine_jobs::JobSystem* jobs = nullptr,
+        engine_init::FrameCommandPools* pools = nullptr) {
+        for (Resource& resource : resources) {
+            resource.touched = false;
+        }
+        std::vector<engine_init::FrameCommandPools::RecordFunction>
+            recorders;
+        for (PassId id : order) {
+            const Pass& pass = passes[id];
+            BarrierTracker::Barriers barriers;
+            const bool fullBarrier = pass.enabled && fullBarriers;
+            if (pass.enabled) {
+                for (const Use& use : pass.uses) {
+                    declare(use);
+                }
+                barriers = tracker.take();
+                fullBarrierCount += fullBarrier ? 1 : 0;
+            }
+            recorders.push_back([&pass, &timer, fullBarrier, barriers](
+                                    vk::CommandBuffer commandBuffer) {
+                if (pass.timer != kNone) {
+                    timer.begin(commandBuffer, pass.timer);
+                }
+                if (pass.enabled) {
+                    if (fullBarrier) {
+                        vk::MemoryBarrier2 barrier;
+                        barrier.setSrcStageMask(
+                            vk::PipelineStageFlagBits2::eAllCommands);
+                        barrier.setSrcAccessMask(
+                            vk::AccessFlagBits2::eMemoryWrite);
+                        barrier.setDstStageMask(
+                            vk::PipelineStageFlagBits2::eAllCommands);
+                        barrier.setDstAccessMask(
+                            vk::AccessFlagBits2::eMemoryRead
+                            | vk::AccessFlagBits2::eMemoryWrite);
+                        vk::DependencyInfo dependencyInfo;
+                        dependencyInfo.setMemoryBarriers(barrier);
+                        commandBuffer.pipelineBarrier2(dependencyInfo);
+                    }
+                    barriers.record(commandBuffer);
+                    if (pass.record) {
+                        pass.record(commandBuffer);
+                    }
+                }
+                if (pass.timer != kNone) {
+                    timer.end(commandBuffer, pass.timer);
+                }
+            });
+        }
+        if (jobs && pools) {
+            pools->RecordSecondaries(*jobs, commandBuffer, recorders);
+            return;
+        }
+        for (const auto& record : recorders) {
+            record(commandBuffer);
+        }
+    }
+
+    // Hands one use to the tracker. The first use of a discarded image
+    // in the frame starts from undefined contents, after whatever used
+    // its memory last.
+    void declare(const Use& use) {
+        Resource& resource = resources[use.resource];
+        if (resource.buffer) {
+            tracker.use(resource.buffer, use.stages, use.access);
+            return;
+        }
+        if (resource.discard && !resource.touched) {
+            if (resource.previousAlias != kNone) {
+                tracker.alias(resources[resource.previousAlias].image,
+                    resource.image);
+            } else {
+                tracker.discard(resource.image);
+            }
+        }
+        resource.touched = true;
+        tracker.use(resource.image, use.layout, use.stages, use.access);
+    }
+
+    std::vector<Pass> passes;
+    std::vector<Resource> resources;
+    // Passes in execution order, culled ones left out
+    std::vector<PassId> order;
+    std::vector<vk::UniqueDeviceMemory> memory;
+    BarrierTracker tracker;
+    // Adds an all-commands barrier before every pass, to measure what
+    // the precise barriers save
+    bool fullBarriers = false;
+    uint64_t fullBarrierCount = 0;
+    vk::DeviceSize transientBytes = 0;
+    vk::DeviceSize aliasedBytes = 0;
+};
+
+// Emissive triangles of every mesh with an area-weighted alias table.
+// Sampling proportional to area makes the area pdf of any light point
+// 1 / totalArea, which keeps the MIS weight for BSDF hits cheap.
+struct LightList {
+    LightList(const Context& context,
+        const std::vector<MeshData>& meshes) {
+        std::vector<EmissiveTriangle> triangles;
+        std::vector<float> areas;
+        for (const MeshData& mesh : meshes) {
+            for (size_t i = 0; i < mesh.faces.size(); i++) {
+                const float* emission = mesh.faces[i].emission;
+                if (emission[0] <= 0.0f && emission[1] <= 0.0f
+                    && emission[2] <= 0.0f) {
+                    continue;
+                }
+                const float* p0 = mesh.vertices[3 * i + 0].position;
+                const float* p1 = mesh.vertices[3 * i + 1].position;
+                const float* p2 = mesh.vertices[3 * i + 2].position;
+                EmissiveTriangle& triangle = triangles.emplace_back();
+                for (int k = 0; k < 3; k++) {
+                    triangle.p0[k] = p0[k];
+                    triangle.e1[k] = p1[k] - p0[k];
+                    triangle.e2[k] = p2[k] - p0[k];
+                }
+                float c[3] = {
+                    triangle.e1[1] * triangle.e2[2]
+                        - triangle.e1[2] * triangle.e2[1],
+                    triangle.e1[2] * triangle.e2[0]
+                        - triangle.e1[0] * triangle.e2[2],
+                    triangle.e1[0] * triangle.e2[1]
+                        - triangle.e1[1] * triangle.e2[0],
+                };
+                triangle.area =
+                    0.5f
+                    * std::sqrt(c[0] * c[0] + c[1] * c[1] + c[2] * c[2]);
+                triangle.emission = packRGB9E5(emission);
+                triangle.normal = mesh.primitives[i].normal;
+                areas.push_back(triangle.area);
+                totalArea += triangle.area;
+            }
+        }
+        count = static_cast<uint32_t>(triangles.size());
+        std::vector<AliasEntry> aliasTable = buildAliasTable(areas);
+
+        // Keep the buffers valid for scenes without lights
+        if (triangles.empty()) {
+            triangles.emplace_back();
+            aliasTable.push_back({1.0f, 0});
+        }
+        triangleBuffer = Buffer{context,
+            Buffer::Type::Storage,
+            sizeof(EmissiveTriangle) * triangles.size(),
+            triangles.data()};
+        aliasBuffer = Buffer{context,
+            Buffer::Type::Storage,
+            sizeof(AliasEntry) * aliasTable.size(),
+            aliasTable.data()};
+    }
+
+    Buffer triangleBuffer;
+    Buffer aliasBuffer;
+    uint32_t count = 0;
+    float totalArea = 0.0f;
+};
+
+// Sobol direction numbers and the blue-noise tile, generated once at
+// startup and read by sampler.glsl through buffer references.
+struct SamplerTables {
+    SamplerTables(const Context& context) {
+        std::vector<uint32_t> directions = buildSobolDirections();
+        std::vector<float> blueNoise = buildBlueNoise(kBlueNoiseSize, 1);
+        sobolBuffer = Buffer{context,
+            Buffer::Type::Storage,
+            sizeof(uint32_t) * directions.size(),
+            directions.data()};
+        blueNoiseBuffer = Buffer{context,
+            Buffer::Type::Storage,
+            sizeof(float) * blueNoise.size(),
+            blueNoise.data()};
+    }
+
+    Buffer sobolBuffer;
+    Buffer blueNoiseBuffer;
+};
+
+// Equirectangular environment as RGB9E5 texels with an alias table over
+// texels weighted by luminance * sin(theta), read by environment.glsl.
+// Weights come from the packed texels so the shader can recompute the
+// exact pdf of any direction.
+struct Environment {
+    Environment(const Context& context, const std::string& path) {
+        int imageWidth = 0;
+        int imageHeight = 0;
+        int channels = 0;
+        float* pixels = stbi_loadf(path.c_str(),
+            &imageWidth,
+            &imageHeight,
+            &channels,
+            3);
+        std::vector<uint32_t> texels;
+        if (pixels) {
+            width = static_cast<uint32_t>(imageWidth);
+            height = static_cast<uint32_t>(imageHeight);
+            texels.resize(size_t(width) * height);
+            for (size_t i = 0; i < texels.size(); i++) {
+                texels[i] = packRGB9E5(pixels + 3 * i);
+            }
+            stbi_image_free(pixels);
+        } else {
+            std::cout << "No environment map at " << path
+                      << ", using a constant sky" << std::endl;
+            const float sky[3] = {0.7f, 0.6f, 0.5f};
+            texels.push_back(packRGB9E5(sky));
+        }
+
+        std::vector<float> weights(texels.size());
+        double total = 0.0;
+        for (uint32_t y = 0; y < height; y++) {
+            const float sinTheta = std::sin(std::numbers::pi_v<float>
+                                            * (float(y) + 0.5f)
+                                            / float(height));
+            for (uint32_t x = 0; x < width; x++) {
+                float rgb[3];
+                unpackRGB9E5(texels[y * width + x], rgb);
+                const float luminance =
+                    0.2126f * rgb[0] + 0.7152f * rgb[1] + 0.0722f * rgb[2];
+                weights[y * width + x] = luminance * sinTheta;
+                total += weights[y * width + x];
+            }
+        }
+        weightScale = total > 0.0 ? float(1.0 / total) : 0.0f;
+        std::vector<AliasEntry> aliasTable = buildAliasTable(weights);
+
+        texelBuffer = Buffer{context,
+            Buffer::Type::Storage,
+            sizeof(uint32_t) * texels.size(),
+            texels.data()};
+        aliasBuffer = Buffer{context,
+            Buffer::Type::Storage,
+            sizeof(AliasEntry) * aliasTable.size(),
+            aliasTable.data()};
+    }
+
+    Buffer texelBuffer;
+    Buffer aliasBuffer;
+    uint32_t width = 1;
+    uint32_t height = 1;
+    float weightScale = 0.0f;
+};
+
+// Must match PushConstants in raygen.rgen
+struct RaygenPushConstants {
+    int frame;
+    uint32_t lightCount;
+    float lightArea;
+    uint32_t flags;
+    uint64_t lightTriangles;
+    uint64_t lightAliasTable;
+    uint64_t sobolDirections;
+    uint64_t blueNoise;
+    uint64_t activePixels;
+    uint32_t samplesPerLaunch;
+    // x in the low 16 bits, y in the high
+    uint32_t tileOffset;
+    uint64_t candidateReservoirs;
+    uint64_t reservoirs;
+    uint64_t environmentTexels;
+    uint64_t environmentAliasTable;
+    uint32_t environmentWidth;
+    uint32_t environmentHeight;
+    float environmentWeightScale;
+    uint64_t wavefront;
+    uint32_t bounce;
+};
+
+enum RaygenFlags : uint32_t {
+    NextEventEstimation = 1 << 0,
+    LowDiscrepancySampler = 1 << 1,
+    AdaptiveLaunch = 1 << 2,
+    Restir = 1 << 3,
+    RestirShade = 1 << 4,
+    WavefrontExtend = 1 << 5,
+    WavefrontShadow = 1 << 6,
+    MultiView = 1 << 7,
+};
+
+// Must match QueueCounter in wavefront.glsl. The dispatch and trace
+// arguments are kept current by the appending shaders.
+struct QueueCounter {
+    uint32_t count;
+    vk::DispatchIndirectCommand groups;
+    vk::TraceRaysIndirectCommandKHR launch;
+    uint32_t pad;
+};
+
+// Must match WavefrontState in wavefront.glsl
+struct WavefrontState {
+    QueueCounter rayCounters[2];
+    QueueCounter shadowCounter;
+    uint32_t binCounts[kMaterialBins];
+    uint32_t binStarts[kMaterialBins];
+    uint64_t rays[2];
+    uint64_t hits;
+    uint64_t shadows;
+    uint64_t sortKeys;
+    uint64_t sorted;
+    uint64_t radiance;
+};
+
+// Must match PathState and ShadowRay in wavefront.glsl
+static constexpr vk::DeviceSize kPathStateSize = 64;
+static constexpr vk::DeviceSize kShadowRaySize = 48;
+// std430 stride of HitPayload
+static constexpr vk::DeviceSize kHitRecordSize = 32;
+
+// Must match PushConstants in wavefront.comp
+struct WavefrontPushConstants {
+    uint32_t stage;
+    uint32_t flags;
+    uint32_t lightCount;
+    float lightArea;
+    uint64_t lightTriangles;
+    uint64_t lightAliasTable;
+    uint64_t sobolDirections;
+    uint64_t blueNoise;
+    uint64_t environmentTexels;
+    uint64_t environmentAliasTable;
+    uint64_t wavefront;
+    uint32_t environmentWidth;
+    uint32_t environmentHeight;
+    float environmentWeightScale;
+    int frame;
+    uint32_t wave;
+    uint32_t bounce;
+};
+
+enum WavefrontStage : uint32_t {
+    WavefrontGenerate,
+    WavefrontHistogram,
+    WavefrontPrefix,
+    WavefrontScatter,
+    WavefrontShade,
+    WavefrontAccumulate,
+};
+
+// Must match PushConstants in rayquery.comp
+struct RayQueryPushConstants {
+    uint64_t wavefront;
+    uint32_t pass;
+    uint32_t bounce;
+};
+
+enum RayQueryPass : uint32_t { RayQueryExtend, RayQueryShadow };
+
+// How a trace pass runs: the ray tracing pipeline through the SBT, or
+// inline ray queries from a compute shader. Both write the same results.
+enum class TraceBackend { Pipeline, RayQuery };
+
+const char* traceBackendName(TraceBackend backend) {
+    return backend == TraceBackend::Pipeline ? "pipeline" : "ray query";
+}
+
+// How the resolved frame reaches the swapchain: the resolve pass writes
+// straight into a storage-capable swapchain image, or into an image of
+// its own that is copied over, or blitted when the window size differs
+// from the render size.
+enum class PresentPath { Compute, Copy, Blit };
+
+const char* presentPathName(PresentPath path) {
+    switch (path) {
+        case PresentPath::Compute:
+            return "compute resolve into the swapchain";
+        case PresentPath::Copy:
+            return "copy";
+        default:
+            return "blit";
+    }
+}
+
+PresentPath choosePresentPath(const Context& context, vk::Format format) {
+    const vk::SurfaceCapabilitiesKHR capabilities =
+        context.physicalDevice.getSurfaceCapabilitiesKHR(
+            *context.surface);
+    const vk::FormatFeatureFlags features =
+        context.physicalDevice.getFormatProperties(format)
+            .optimalTilingFeatures;
+    if ((capabilities.supportedUsageFlags
+            & vk::ImageUsageFlagBits::eStorage)
+        && (features & vk::FormatFeatureFlagBits::eStorageImage)) {
+        return PresentPath::Compute;
+    }
+    if (WIDTH == kWindowWidth && HEIGHT == kWindowHeight) {
+        return PresentPath::Copy;
+    }
+    return PresentPath::Blit;
+}
+
+// Must match Reservoir in restir.glsl
+struct Reservoir {
+    float position[3];
+    uint32_t normal;
+    uint32_t light;
+    uint32_t barycentrics;
+    float W;
+    float M;
+};
+
+// Must match PushConstants in restir.comp
+struct RestirPushConstants {
+    uint64_t candidates;
+    uint64_t reservoirs;
+    uint64_t lightTriangles;
+    uint32_t pass;
+    int frame;
+    float depthTolerance = kReprojectDepthTolerance;
+    float normalTolerance = kReprojectNormalTolerance;
+    uint32_t renderWidth;
+    uint32_t renderHeight;
+    // Extent last frame's reservoirs were written at
+    uint32_t historyWidth;
+    uint32_t historyHeight;
+};
+
+enum RestirStage : uint32_t { RestirTemporal, RestirSpatial };
+
+// Must match PushConstants in adaptive.comp
+struct AdaptivePushConstants {
+    uint64_t activePixels;
+    uint64_t launchArgs;
+    float errorThreshold;
+    uint32_t samplesPerLaunch;
+    uint32_t maxSamples;
+    uint32_t renderWidth;
+    uint32_t renderHeight;
+};
+
+// Must match PushConstants in atrous.comp
+struct AtrousPushConstants {
+    int stepSize;
+    uint32_t flags;
+    float sigmaLuminance = 4.0f;
+    float sigmaNormal = 128.0f;
+    float sigmaDepth = 0.1f;
+    uint32_t renderWidth;
+    uint32_t renderHeight;
+};
+
+enum AtrousFlags : uint32_t {
+    FirstIteration = 1 << 0,
+};
+
+// Must match PushConstants in reproject.comp
+struct ReprojectPushConstants {
+    uint32_t flags;
+    float depthTolerance = kReprojectDepthTolerance;
+    float normalTolerance = kReprojectNormalTolerance;
+    float maxHistory = kMaxHistorySamples;
+    uint32_t renderWidth;
+    uint32_t renderHeight;
+    // Extent the history was accumulated at
+    uint32_t historyWidth;
+    uint32_t historyHeight;
+};
+
+// Must match PushConstants in resolve.comp
+struct ResolvePushConstants {
+    uint32_t renderWidth;
+    uint32_t renderHeight;
+};
+
+enum ReprojectFlags : uint32_t {
+    ResetHistory = 1 << 0,
+    StillCamera = 1 << 1,
+};
+
+// Must match CameraBuffer in raygen.rgen
+struct CameraUniform {
+    glm::mat4 viewProj;
+    glm::mat4 prevViewProj;
+    glm::mat4 invViewProj;
+    glm::vec4 position;
+    glm::uvec2 renderSize;
+};
+
+// Must match CameraRecord in raygen.rgen: one batch view, without the
+// render size, so the std430 stride stays 208 bytes
+struct CameraRecord {
+    glm::mat4 viewProj;
+    glm::mat4 prevViewProj;
+    glm::mat4 invViewProj;
+    glm::vec4 position;
+};
+static_assert(sizeof(CameraRecord) == 208);
+
+// Fly camera on the arrow keys. The default pose and field of view are
+// the ones raygen.rgen used to hardcode: an image plane 3 units ahead
+// with a half-extent of 1.
+struct Camera {
+    glm::vec3 position{0.0f, -1.0f, 5.0f};
+    float yaw = 0.0f;
+
+    glm::vec3 forward() const {
+        return {std::sin(yaw), 0.0f, -std::cos(yaw)};
+    }
+
+    glm::mat4 viewProj() const {
+        glm::mat4 projection =
+            glm::perspective(2.0f * std::atan(1.0f / 3.0f),
+                float(WIDTH) / float(HEIGHT),
+                0.01f,
+                1000.0f);
+        return projection
+               * glm::lookAt(position,
+                   position + forward(),
+                   glm::vec3(0.0f, 1.0f, 0.0f));
+    }
+
+    // Returns true if the camera moved
+    bool update(GLFWwindow* window, float seconds) {
+        auto pressed = [&](int key) {
+            return glfwGetKey(window, key) == GLFW_PRESS;
+        };
+        const glm::vec3 startPosition = position;
+        const float startYaw = yaw;
+        const float step = kCameraMoveSpeed * seconds;
+        if (pressed(GLFW_KEY_UP)) {
+            position += forward() * step;
+        }
+        if (pressed(GLFW_KEY_DOWN)) {
+            position -= forward() * step;
+        }
+        if (pressed(GLFW_KEY_LEFT)) {
+            yaw -= kCameraTurnSpeed * seconds;
+        }
+        if (pressed(GLFW_KEY_RIGHT)) {
+            yaw += kCameraTurnSpeed * seconds;
+        }
+        // The loader negates y, so world -y is up on screen
+        if (pressed(GLFW_KEY_PAGE_UP)) {
+            position.y -= step;
+        }
+        if (pressed(GLFW_KEY_PAGE_DOWN)) {
+            position.y += step;
+        }
+        return position != startPosition || yaw != startYaw;
+    }
+
+    CameraRecord record() const {
+        const glm::mat4 matrix = viewProj();
+        return {matrix,
+            matrix,
+            glm::inverse(matrix),
+            glm::vec4(position, 1.0f)};
+    }
+};
+
+// Picks the render resolution from the GPU time of the trace passes.
+// Their cost follows the pixel count, so the scale of each side moves
+// by the square root of target over measured time. Measurements are
+// smoothed, and the size only changes when it would gain or shed more
+// than a tenth of the pixels, since every change resamples the history.
+struct ResolutionController {
+    float scale = 1.0f;
+    double milliseconds = 0.0;
+    int frames = 0;
+
+    // Returns true when the render extent changed
+    bool update(double traceMilliseconds) {
+        if (frames == 0) {
+            milliseconds = traceMilliseconds;
+        }
+        milliseconds += 0.2 * (traceMilliseconds - milliseconds);
+        if (++frames < kResolutionSettleFrames) {
+            return false;
+        }
+        const float step =
+            float(std::sqrt(kTargetTraceMilliseconds / milliseconds));
+        const float wanted =
+            std::clamp(scale * step, kMinRenderScale, 1.0f);
+        const float pixelRatio = (wanted * wanted) / (scale * scale);
+        if (pixelRatio > 0.9f && pixelRatio < 1.1f) {
+            return false;
+        }
+        const vk::Extent2D before = extent();
+        scale = wanted;
+        frames = 0;
+        return extent() != before;
+    }
+
+    // Rounded down to whole 8x8 work groups
+    vk::Extent2D extent() const {
+        auto side = [&](int size) {
+            return std::max(8u, uint32_t(float(size) * scale) & ~7u);
+        };
+        return {side(WIDTH), side(HEIGHT)};
+    }
+};
+
+// Columns and rows of kTraceTileSize tiles covering `extent`
+vk::Extent2D tileGrid(vk::Extent2D extent) {
+    return {(extent.width + kTraceTileSize - 1) / kTraceTileSize,
+        (extent.height + kTraceTileSize - 1) / kTraceTileSize};
+}
+
+// Product-shot orbit for the batch driver: `count` views spread over
+// kBatchArc, all looking at the point kBatchOrbitRadius ahead of the
+// default camera
+std::vector<CameraRecord> orbitViews(uint32_t count) {
+    const Camera base;
+    const glm::vec3 center =
+        base.position + base.forward() * kBatchOrbitRadius;
+    std::vector<CameraRecord> views;
+    for (uint32_t i = 0; i < count; i++) {
+        Camera camera;
+        if (count > 1) {
+            camera.yaw = kBatchArc * (float(i) / float(count - 1) - 0.5f);
+        }
+        camera.position = center - camera.forward() * kBatchOrbitRadius;
+        views.push_back(camera.record());
+    }
+    return views;
+}
+
+// Same ACES fit and sRGB curve as resolve.comp, for views written from
+// the host
+uint8_t toDisplay(float c) {
+    const float x = std::max(c, 0.0f);
+    const float mapped = std::clamp(
+        (x * (2.51f * x + 0.03f)) / (x * (2.43f * x + 0.59f) + 0.14f),
+        0.0f,
+        1.0f);
+    const float srgb =
+        mapped <= 0.0031308f
+            ? mapped * 12.92f
+            : 1.055f * std::pow(mapped, 1.0f / 2.4f) - 0.055f;
+    return static_cast<uint8_t>(std::lround(srgb * 255.0f));
+}
+
+struct Mesh {
+    Mesh(const Context& context, const MeshData& data)
+        : vertexBuffer{context,
+              Buffer::Type::AccelInput,
+              sizeof(Vertex) * data.vertices.size(),
+              data.vertices.data()}
+        , indexBuffer{context,
+              Buffer::Type::AccelInput,
+              sizeof(uint32_t) * data.indices.size(),
+              data.indices.data()}
+        , faceBuffer{context,
+              Buffer::Type::AccelInput,
+              sizeof(Face) * data.faces.size(),
+              data.faces.data()}
+        , primitiveBuffer{context,
+              Buffer::Type::Storage,
+              sizeof(PrimitiveInfo) * data.primitives.size(),
+              data.primitives.data()} {
+        vk::AccelerationStructureGeometryTrianglesDataKHR triangleData;
+        triangleData.setVertexFormat(vk::Format::eR32G32B32Sfloat);
+        triangleData.setVertexData(vertexBuffer.deviceAddress);
+        triangleData.setVertexStride(sizeof(Vertex));
+        triangleData.setMaxVertex(
+            static_cast<uint32_t>(data.vertices.size()));
+        triangleData.setIndexType(vk::IndexType::eUint32);
+        triangleData.setIndexData(indexBuffer.deviceAddress);
+
+        vk::AccelerationStructureGeometryKHR triangleGeometry;
+        triangleGeometry.setGeometryType(vk::GeometryTypeKHR::eTriangles);
+        triangleGeometry.setGeometry({triangleData});
+        triangleGeometry.setFlags(vk::GeometryFlagBitsKHR::eOpaque);
+
+        const auto primitiveCount =
+            static_cast<uint32_t>(data.indices.size() / 3);
+        bottomAccel = Accel{context,
+            triangleGeometry,
+            primitiveCount,
+            vk::AccelerationStructureTypeKHR::eBottomLevel,
+            {*vertexBuffer.buffer, *indexBuffer.buffer}};
+    }
+
+    SceneInstance sceneInstance() const {
+        return {vertexBuffer.deviceAddress,
+            indexBuffer.deviceAddress,
+            faceBuffer.deviceAddress,
+            primitiveBuffer.deviceAddress};
+    }
+
+    Buffer vertexBuffer;
+    Buffer indexBuffer;
+    Buffer faceBuffer;
+    Buffer primitiveBuffer;
+    Accel bottomAccel;
+};
+
+// Interactive path tracer, or with `batchViews` a headless batch that
+// renders that many orbitViews() in shared launches and writes each one
+// to view_<n>.png
+int run(uint32_t batchViews = 0) {
+    // Batches never present: the present passes are built but never
+    // executed, against a null swapchain image
+    const bool headless = batchViews > 0;
+    Context context{headless};
+
+    const vk::Format swapchainFormat = vk::Format::eB8G8R8A8Unorm;
+    const vk::Extent2D windowExtent{kWindowWidth, kWindowHeight};
+    const PresentPath presentPath = headless
+                                        ? PresentPath::Copy
+                                        : choosePresentPath(context,
+                                              swapchainFormat);
+    vk::UniqueSwapchainKHR swapchain;
+    std::vector<vk::Image> swapchainImages;
+    if (!headless) {
+        std::cout << "Present: " << presentPathName(presentPath) << ", "
+                  << WIDTH << "x" << HEIGHT << " to " << kWindowWidth
+                  << "x" << kWindowHeight << std::endl;
+
+        vk::SwapchainCreateInfoKHR swapchainInfo;
+        swapchainInfo.setSurface(*context.surface);
+        swapchainInfo.setMinImageCount(3);
+        swapchainInfo.setImageFormat(swapchainFormat);
+        swapchainInfo.setImageColorSpace(
+            vk::ColorSpaceKHR::eSrgbNonlinear);
+        swapchainInfo.setImageExtent(windowExtent);
+        swapchainInfo.setImageArrayLayers(1);
+        const vk::ImageUsageFlags swapchainUsage =
+            presentPath == PresentPath::Compute
+                ? vk::ImageUsageFlagBits::eStorage
+                : vk::ImageUsageFlagBits::eTransferDst;
+        swapchainInfo.setImageUsage(swapchainUsage);
+        swapchainInfo.setPreTransform(
+            vk::SurfaceTransformFlagBitsKHR::eIdentity);
+        swapchainInfo.setPresentMode(vk::PresentModeKHR::eFifo);
+        swapchainInfo.setClipped(true);
+        swapchainInfo.setQueueFamilyIndices(context.queueFamilyIndex);
+        swapchain =
+            context.device->createSwapchainKHRUnique(swapchainInfo);
+        swapchainImages =
+            context.device->getSwapchainImagesKHR(*swapchain);
+    }
+
+    // Storage views the resolve pass writes through on the compute path
+    std::vector<vk::UniqueImageView> swapchainViews;
+    if (presentPath == PresentPath::Compute) {
+        for (vk::Image swapchainImage : swapchainImages) {
+            vk::ImageViewCreateInfo imageViewInfo;
+            imageViewInfo.setImage(swapchainImage);
+            imageViewInfo.setViewType(vk::ImageViewType::e2D);
+            imageViewInfo.setFormat(swapchainFormat);
+            imageViewInfo.setSubresourceRange(
+                {vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1});
+            swapchainViews.push_back(
+                context.device->createImageViewUnique(imageViewInfo));
+        }
+    }
+    // Signalled by the frame that renders into each swapchain image,
+    // waited on by its present
+    std::vector<vk::UniqueSemaphore> renderedSemaphores;
+    for (size_t i = 0; i < swapchainImages.size(); i++) {
+        renderedSemaphores.push_back(
+            context.device->createSemaphoreUnique({}));
+    }
+
+    // Running mean in rgb, sample count in alpha. Only the resolve pass
+    // turns it into display values, so precision never stalls
+    // convergence.
+    Image accumImage{context,
+        {WIDTH, HEIGHT},
+        vk::Format::eR32G32B32A32Sfloat,
+        vk::ImageUsageFlagBits::eStorage
+            | vk::ImageUsageFlagBits::eTransferSrc};
+
+    // Per-pixel luminance moments for the variance estimate, and the
+    // sample budget the adaptive pass hands to the next launch
+    Image momentsImage{context,
+        {WIDTH, HEIGHT},
+        vk::Format::eR32G32B32A32Sfloat,
+        vk::ImageUsageFlagBits::eStorage
+            | vk::ImageUsageFlagBits::eTransferSrc};
+    Image budgetImage{context,
+        {WIDTH, HEIGHT},
+        vk::Format::eR32Uint,
+        vk::ImageUsageFlagBits::eStorage};
+    // Next Sobol index of each pixel, counted apart from the
+    // accumulation, whose sample count the reprojection caps
+    Image sampleIndexImage{context,
+        {WIDTH, HEIGHT},
+        vk::Format::eR32Uint,
+        vk::ImageUsageFlagBits::eStorage};
+
+    // Denoiser guides written at the primary hit
+    Image guideImage{context,
+        {WIDTH, HEIGHT},
+        vk::Format::eR32G32B32A32Uint,
+        vk::ImageUsageFlagBits::eStorage
+            | vk::ImageUsageFlagBits::eTransferSrc};
+
+    // The trace writes this frame's samples into a render graph
+    // transient; the reprojection pass blends them into the accumulation
+    // using copies of last frame.
+    Image historyAccumImage{context,
+        {WIDTH, HEIGHT},
+        vk::Format::eR32G32B32A32Sfloat,
+        vk::ImageUsageFlagBits::eStorage
+            | vk::ImageUsageFlagBits::eTransferDst};
+    Image historyMomentsImage{context,
+        {WIDTH, HEIGHT},
+        vk::Format::eR32G32B32A32Sfloat,
+        vk::ImageUsageFlagBits::eStorage
+            | vk::ImageUsageFlagBits::eTransferDst};
+    Image historyGuideImage{context,
+        {WIDTH, HEIGHT},
+        vk::Format::eR32G32B32A32Uint,
+        vk::ImageUsageFlagBits::eStorage
+            | vk::ImageUsageFlagBits::eTransferDst};
+
+    // Multi-view batch target, one layer per view: running mean in rgb,
+    // sample count in alpha. Interactive runs only bind a single texel.
+    const uint32_t viewCount = std::max(batchViews, 1u);
+    Image viewImage{context,
+        headless ? vk::Extent2D{WIDTH, HEIGHT} : vk::Extent2D{1, 1},
+        vk::Format::eR32G32B32A32Sfloat,
+        vk::ImageUsageFlagBits::eStorage
+            | vk::ImageUsageFlagBits::eTransferSrc,
+        viewCount,
+        true};
+
+    // Load meshes
+    std::vector<MeshData> meshData;
+    loadFromFile(meshData);
+
+    // Meshes are never moved after construction: the BLAS build and
+    // the instance records hold on to their buffers.
+    std::vector<Mesh> meshes;
+    meshes.reserve(meshData.size());
+    for (const MeshData& data : meshData) {
+        meshes.emplace_back(context, data);
+    }
+
+    LightList lights{context, meshData};
+    SamplerTables samplerTables{context};
+    Environment environment{context, kEnvironmentPath};
+    std::cout << "Lights: " << lights.count << " emissive triangles, area "
+              << lights.totalArea << std::endl;
+
+    // Create top level accel struct
+    vk::TransformMatrixKHR transformMatrix = std::array{
+        std::array{1.0f, 0.0f, 0.0f, 0.0f},
+        std::array{0.0f, 1.0f, 0.0f, 0.0f},
+        std::array{0.0f, 0.0f, 1.0f, 0.0f},
+    };
+
+    std::vector<vk::AccelerationStructureInstanceKHR> accelInstances;
+    std::vector<SceneInstance> sceneInstances;
+    std::vector<vk::Buffer> bottomAccelBuffers;
+    for (uint32_t i = 0; i < meshes.size(); i++) {
+        vk::AccelerationStructureInstanceKHR& accelInstance =
+            accelInstances.emplace_back();
+        accelInstance.setTransform(transformMatrix);
+        accelInstance.setInstanceCustomIndex(i);
+        accelInstance.setMask(0xFF);
+        accelInstance.setAccelerationStructureReference(
+            meshes[i].bottomAccel.buffer.deviceAddress);
+        accelInstance.setFlags(
+            vk::GeometryInstanceFlagBitsKHR::eTriangleFacingCullDisable);
+        sceneInstances.push_back(meshes[i].sceneInstance());
+        bottomAccelBuffers.push_back(*meshes[i].bottomAccel.buffer.buffer);
+    }
 
     Buffer instancesBuffer{context,
         Buffer::Type::AccelInput,
-        sizeof(vk::AccelerationStructureInstanceKHR),
-        &accelInstance};
+        sizeof(vk::AccelerationStructureInstanceKHR)
+            * accelInstances.size(),
+        accelInstances.data()};
+
+    // One record per instance; the hit shader follows its device
+    // addresses, so adding meshes needs no descriptor updates.
+    Buffer sceneInstanceBuffer{context,
+        Buffer::Type::Storage,
+        sizeof(SceneInstance) * sceneInstances.size(),
+        sceneInstances.data()};
 
     vk::AccelerationStructureGeometryInstancesDataKHR instancesData;
     instancesData.setArrayOfPointers(false);
@@ -679,18 +3091,359 @@ int run() {
 
     Accel topAccel{context,
         instanceGeometry,
-        1,
-        vk::AccelerationStructureTypeKHR::eTopLevel};
+        static_cast<uint32_t>(accelInstances.size()),
+        vk::AccelerationStructureTypeKHR::eTopLevel,
+        bottomAccelBuffers};
+
+    // Rays traced in the current frame, written by the raygen shader
+    uint32_t rayCount = 0;
+    Buffer rayCounterBuffer{context,
+        Buffer::Type::Storage,
+        sizeof(uint32_t),
+        &rayCount};
+
+    // Compacted list of pixels above the error target and the indirect
+    // launch size over it, rebuilt by the adaptive pass every frame
+    Buffer activePixelBuffer{context,
+        Buffer::Type::Storage,
+        sizeof(uint32_t) * WIDTH * HEIGHT};
+    Buffer launchArgsBuffer{context,
+        Buffer::Type::Indirect,
+        sizeof(vk::TraceRaysIndirectCommandKHR)};
+
+    // The ray count and active pixel count of each frame in flight,
+    // copied out at the end of the frame, as the counters themselves
+    // are already in use by the next one when the host gets to them
+    struct FrameReadback {
+        uint32_t rays;
+        uint32_t activePixels;
+    };
+    Buffer frameReadbackBuffer{context,
+        Buffer::Type::Readback,
+        sizeof(FrameReadback) * kFramesInFlight};
+    const auto* frameReadbacks = static_cast<const FrameReadback*>(
+        context.device->mapMemory(*frameReadbackBuffer.memory,
+            0,
+            sizeof(FrameReadback) * kFramesInFlight));
+
+    // One reservoir per pixel: initial candidates (reused in place by the
+    // temporal pass) and the spatially resampled result, which is also
+    // next frame's temporal history
+    Buffer candidateReservoirBuffer{context,
+        Buffer::Type::DeviceStorage,
+        sizeof(Reservoir) * WIDTH * HEIGHT};
+    Buffer reservoirBuffer{context,
+        Buffer::Type::DeviceStorage,
+        sizeof(Reservoir) * WIDTH * HEIGHT};
+
+    // Wavefront queues with one entry per pixel: two extension queues
+    // that ping-pong between bounces, the hits of the one just traced
+    // with their sort keys and material order, the shadow queue, and the
+    // radiance of each pixel's path
+    const vk::DeviceSize pixelCount = WIDTH * HEIGHT;
+    Buffer pathQueueBuffers[2] = {
+        Buffer{context,
+            Buffer::Type::DeviceStorage,
+            kPathStateSize * pixelCount},
+        Buffer{context,
+            Buffer::Type::DeviceStorage,
+            kPathStateSize * pixelCount},
+    };
+    Buffer hitRecordBuffer{context,
+        Buffer::Type::DeviceStorage,
+        kHitRecordSize * pixelCount};
+    Buffer sortKeyBuffer{context,
+        Buffer::Type::DeviceStorage,
+        sizeof(uint32_t) * pixelCount};
+    Buffer sortedHitBuffer{context,
+        Buffer::Type::DeviceStorage,
+        sizeof(uint32_t) * pixelCount};
+    Buffer shadowQueueBuffer{context,
+        Buffer::Type::DeviceStorage,
+        kShadowRaySize * pixelCount};
+    Buffer pathRadianceBuffer{context,
+        Buffer::Type::DeviceStorage,
+        4 * sizeof(float) * pixelCount};
+
+    // Queue counters double as indirect arguments, next to the queue
+    // addresses the shaders follow
+    WavefrontState wavefrontState{};
+    wavefrontState.rays[0] = pathQueueBuffers[0].deviceAddress;
+    wavefrontState.rays[1] = pathQueueBuffers[1].deviceAddress;
+    wavefrontState.hits = hitRecordBuffer.deviceAddress;
+    wavefrontState.shadows = shadowQueueBuffer.deviceAddress;
+    wavefrontState.sortKeys = sortKeyBuffer.deviceAddress;
+    wavefrontState.sorted = sortedHitBuffer.deviceAddress;
+    wavefrontState.radiance = pathRadianceBuffer.deviceAddress;
+    Buffer wavefrontStateBuffer{context,
+        Buffer::Type::Indirect,
+        sizeof(WavefrontState),
+        &wavefrontState};
+
+    // Camera records of the batch, indexed by the launch depth
+    const std::vector<CameraRecord> views = orbitViews(viewCount);
+    Buffer viewBuffer{context,
+        Buffer::Type::Storage,
+        sizeof(CameraRecord) * views.size(),
+        views.data()};
+
+    // Frames update the camera in their command buffer, so a frame
+    // still in flight keeps the camera it was recorded with
+    Camera camera;
+    CameraUniform cameraUniform{};
+    cameraUniform.renderSize = {WIDTH, HEIGHT};
+    Buffer cameraBuffer{context,
+        Buffer::Type::Uniform,
+        sizeof(CameraUniform),
+        &cameraUniform};
+
+    enum TimerPass : uint32_t {
+        AdaptivePass,
+        TracePass,
+        RestirPass,
+        ReprojectPass,
+        ResolvePass,
+        PresentPass,
+        DenoisePass,
+        TimerPassCount = DenoisePass + kDenoiseIterations,
+    };
+    // One query pool per frame in flight
+    std::vector<GpuTimer> gpuTimers;
+    for (uint32_t i = 0; i < kFramesInFlight; i++) {
+        gpuTimers.emplace_back(context, TimerPassCount);
+    }
+
+    // Frame passes and what they touch. Persistent images and the
+    // buffers passes hand to each other are imported; this frame's
+    // samples, the a-trous ping-pong targets and the display image only
+    // live within the frame and share memory where their lifetimes
+    // allow. Bodies are filled in once the pipelines exist.
+    using Stage = vk::PipelineStageFlagBits2;
+    using Access = vk::AccessFlagBits2;
+    const vk::PipelineStageFlags2 traceStages =
+        Stage::eRayTracingShaderKHR | Stage::eComputeShader;
+    const vk::AccessFlags2 storageRead = Access::eShaderStorageRead;
+    const vk::AccessFlags2 storageWrite =
+        Access::eShaderStorageRead | Access::eShaderStorageWrite;
+    RenderGraph graph;
+    const vk::ImageLayout general = vk::ImageLayout::eGeneral;
+    const auto accum =
+        graph.importImage("accum", *accumImage.image, general);
+    const auto moments =
+        graph.importImage("moments", *momentsImage.image, general);
+    const auto budget =
+        graph.importImage("budget", *budgetImage.image, general);
+    const auto guide =
+        graph.importImage("guide", *guideImage.image, general);
+    const auto sampleIndex = graph.importImage("sample index",
+        *sampleIndexImage.image,
+        general);
+    const auto historyAccum = graph.importImage("history accum",
+        *historyAccumImage.image,
+        general);
+    const auto historyMoments = graph.importImage("history moments",
+        *historyMomentsImage.image,
+        general);
+    const auto historyGuide = graph.importImage("history guide",
+        *historyGuideImage.image,
+        general);
+    const auto swapchainImage = graph.importImage("swapchain",
+        headless ? vk::Image() : swapchainImages[0],
+        vk::ImageLayout::eUndefined,
+        true);
+    const auto activePixels =
+        graph.importBuffer("active pixels", *activePixelBuffer.buffer);
+    const auto launchArgsResource =
+        graph.importBuffer("launch args", *launchArgsBuffer.buffer);
+    const auto candidateReservoirs = graph.importBuffer("candidates",
+        *candidateReservoirBuffer.buffer);
+    const auto reservoirs =
+        graph.importBuffer("reservoirs", *reservoirBuffer.buffer);
+    const auto rayCounterResource =
+        graph.importBuffer("ray counter", *rayCounterBuffer.buffer);
+
+    const auto sample = graph.createImage(context,
+        "sample",
+        {WIDTH, HEIGHT},
+        vk::Format::eR32G32B32A32Sfloat,
+        vk::ImageUsageFlagBits::eStorage
+            | vk::ImageUsageFlagBits::eTransferDst);
+    RenderGraph::ResourceId denoised[2];
+    for (uint32_t i = 0; i < 2; i++) {
+        denoised[i] = graph.createImage(context,
+            "denoise " + std::to_string(i),
+            {WIDTH, HEIGHT},
+            vk::Format::eR32G32B32A32Sfloat,
+            vk::ImageUsageFlagBits::eStorage);
+    }
+    // Display image at render resolution, unless the resolve pass can
+    // write the swapchain image itself
+    const bool computePresent = presentPath == PresentPath::Compute;
+    RenderGraph::ResourceId output = RenderGraph::kNone;
+    if (!computePresent) {
+        output = graph.createImage(context,
+            "output",
+            {WIDTH, HEIGHT},
+            swapchainFormat,
+            vk::ImageUsageFlagBits::eStorage
+                | vk::ImageUsageFlagBits::eTransferSrc
+                | vk::ImageUsageFlagBits::eTransferDst);
+    }
+
+    // Keep last frame for reprojection and start this frame's samples
+    // from zero, adaptive launches leave most pixels untouched
+    const auto historyNode = graph.addPass("history");
+    for (auto [from, to] : {std::pair{accum, historyAccum},
+             std::pair{moments, historyMoments},
+             std::pair{guide, historyGuide}}) {
+        graph.use(historyNode, from, Stage::eCopy, Access::eTransferRead);
+        graph.use(historyNode, to, Stage::eCopy, Access::eTransferWrite);
+    }
+    graph.use(historyNode, sample, Stage::eClear, Access::eTransferWrite);
+
+    const auto adaptiveNode = graph.addPass("adaptive", AdaptivePass);
+    graph.use(adaptiveNode, accum, Stage::eComputeShader, storageRead);
+    graph.use(adaptiveNode, moments, Stage::eComputeShader, storageRead);
+    graph.use(adaptiveNode,
+        budget,
+        Stage::eComputeShader,
+        Access::eShaderStorageWrite);
+    graph.use(adaptiveNode,
+        activePixels,
+        Stage::eComputeShader,
+        storageWrite);
+    graph.use(adaptiveNode,
+        launchArgsResource,
+        Stage::eClear | Stage::eComputeShader,
+        Access::eTransferWrite | storageWrite);
+
+    // Megakernel or wavefront, so both the ray tracing and the compute
+    // stages
+    const auto traceNode = graph.addPass("trace", TracePass);
+    graph.use(traceNode, sampleIndex, traceStages, storageWrite);
+    graph.use(traceNode, budget, traceStages, storageRead);
+    graph.use(traceNode, activePixels, traceStages, storageRead);
+    graph.use(traceNode,
+        launchArgsResource,
+        Stage::eDrawIndirect,
+        Access::eIndirectCommandRead);
+    graph.use(traceNode, moments, traceStages, storageWrite);
+    graph.use(traceNode, guide, traceStages, storageWrite);
+    graph.use(traceNode, sample, traceStages, storageWrite);
+    graph.use(traceNode, candidateReservoirs, traceStages, storageWrite);
+    graph.use(traceNode, rayCounterResource, traceStages, storageWrite);
+
+    const auto restirNode = graph.addPass("restir", RestirPass);
+    graph.use(restirNode, guide, traceStages, storageRead);
+    graph.use(restirNode, historyGuide, traceStages, storageRead);
+    graph.use(restirNode,
+        candidateReservoirs,
+        traceStages,
+        storageWrite);
+    graph.use(restirNode, reservoirs, traceStages, storageWrite);
+    graph.use(restirNode, sample, traceStages, storageWrite);
+    graph.use(restirNode, moments, traceStages, storageWrite);
+    graph.use(restirNode, rayCounterResource, traceStages, storageWrite);
+
+    // Declaring the history images as read here is what orders the
+    // reprojection after the history copies: the tracker puts a
+    // transfer write to compute read barrier between them
+    const auto reprojectNode = graph.addPass("reproject", ReprojectPass);
+    for (auto resource :
+        {sample, guide, historyAccum, historyMoments, historyGuide}) {
+        graph.use(reprojectNode,
+            resource,
+            Stage::eComputeShader,
+            storageRead);
+    }
+    graph.use(reprojectNode, accum, Stage::eComputeShader, storageWrite);
+    graph.use(reprojectNode,
+        moments,
+        Stage::eComputeShader,
+        storageWrite);
+
+    // Iteration i writes denoised[i % 2] from the other one, the first
+    // from the accumulation
+    RenderGraph::PassId atrousNodes[kDenoiseIterations];
+    for (uint32_t i = 0; i < kDenoiseIterations; i++) {
+        atrousNodes[i] = graph.addPass("atrous " + std::to_string(i),
+            DenoisePass + i);
+        for (auto resource : {accum, moments, guide}) {
+            graph.use(atrousNodes[i],
+                resource,
+                Stage::eComputeShader,
+                storageRead);
+        }
+        if (i > 0) {
+            graph.use(atrousNodes[i],
+                denoised[1 - i % 2],
+                Stage::eComputeShader,
+                storageRead);
+        }
+        graph.use(atrousNodes[i],
+            denoised[i % 2],
+            Stage::eComputeShader,
+            Access::eShaderStorageWrite);
+    }
+
+    // Tonemap accumulation or denoiser output into the display image,
+    // scaling it to the window on the compute path, then copy or blit
+    // the display image to the swapchain on the others
+    const auto resolveNode = graph.addPass("resolve", ResolvePass);
+    graph.use(resolveNode, accum, Stage::eComputeShader, storageRead);
+    graph.use(resolveNode,
+        denoised[(kDenoiseIterations - 1) % 2],
+        Stage::eComputeShader,
+        storageRead);
+    graph.use(resolveNode,
+        computePresent ? swapchainImage : output,
+        Stage::eComputeShader,
+        Access::eShaderStorageWrite);
+
+    RenderGraph::PassId copyNode = RenderGraph::kNone;
+    if (!computePresent) {
+        const bool blit = presentPath == PresentPath::Blit;
+        const vk::PipelineStageFlags2 copyStage =
+            blit ? Stage::eBlit : Stage::eCopy;
+        copyNode = graph.addPass(blit ? "blit" : "copy", PresentPass);
+        graph.use(copyNode,
+            output,
+            copyStage,
+            Access::eTransferRead,
+            vk::ImageLayout::eTransferSrcOptimal);
+        graph.use(copyNode,
+            swapchainImage,
+            copyStage,
+            Access::eTransferWrite,
+            vk::ImageLayout::eTransferDstOptimal);
+    }
+
+    // Presentation waits on the semaphore, so only the layout changes.
+    // It carries the present timestamps when there is no copy.
+    const auto presentNode = graph.addPass("present",
+        computePresent ? PresentPass : RenderGraph::kNone);
+    graph.use(presentNode,
+        swapchainImage,
+        Stage::eNone,
+        Access::eNone,
+        vk::ImageLayout::ePresentSrcKHR);
+
+    graph.compile(context);
+    const Image& sampleImage = graph.image(sample);
+    const Image* denoiseImages[2] = {&graph.image(denoised[0]),
+        &graph.image(denoised[1])};
 
     // Load shaders
     const std::vector<char> raygenCode =
         readFile("./shaders/raygen.rgen.spv");
     const std::vector<char> missCode =
         readFile("./shaders/miss.rmiss.spv");
+    const std::vector<char> shadowMissCode =
+        readFile("./shaders/shadow.rmiss.spv");
     const std::vector<char> chitCode =
         readFile("./shaders/closesthit.rchit.spv");
 
-    std::vector<vk::UniqueShaderModule> shaderModules(3);
+    std::vector<vk::UniqueShaderModule> shaderModules(4);
     shaderModules[0] = context.device->createShaderModuleUnique({{},
         raygenCode.size(),
         reinterpret_cast<const uint32_t*>(raygenCode.data())});
@@ -698,24 +3451,65 @@ int run() {
         missCode.size(),
         reinterpret_cast<const uint32_t*>(missCode.data())});
     shaderModules[2] = context.device->createShaderModuleUnique({{},
+        shadowMissCode.size(),
+        reinterpret_cast<const uint32_t*>(shadowMissCode.data())});
+    shaderModules[3] = context.device->createShaderModuleUnique({{},
         chitCode.size(),
         reinterpret_cast<const uint32_t*>(chitCode.data())});
 
-    std::vector<vk::PipelineShaderStageCreateInfo> shaderStages(3);
+    // Specialization constants of raygen and closest hit
+    struct RaygenSpecialization {
+        vk::Bool32 countRays = kCountRays;
+        uint32_t samplingMode = static_cast<uint32_t>(kSamplingMode);
+        uint32_t russianRouletteDepth = kRussianRouletteDepth;
+        uint32_t restirCandidates = kRestirCandidates;
+    } raygenConstants;
+    const vk::Bool32 usePrimitiveInfo = kUsePrimitiveInfo;
+    std::vector<vk::SpecializationMapEntry> raygenEntries{
+        {0, offsetof(RaygenSpecialization, countRays), sizeof(vk::Bool32)},
+        {1, offsetof(RaygenSpecialization, samplingMode), sizeof(uint32_t)},
+        {2,
+            offsetof(RaygenSpecialization, russianRouletteDepth),
+            sizeof(uint32_t)},
+        {3,
+            offsetof(RaygenSpecialization, restirCandidates),
+            sizeof(uint32_t)},
+    };
+    vk::SpecializationMapEntry specializationEntry{0,
+        0,
+        sizeof(vk::Bool32)};
+    vk::SpecializationInfo raygenSpecialization{
+        static_cast<uint32_t>(raygenEntries.size()),
+        raygenEntries.data(),
+        sizeof(RaygenSpecialization),
+        &raygenConstants};
+    vk::SpecializationInfo chitSpecialization{1,
+        &specializationEntry,
+        sizeof(vk::Bool32),
+        &usePrimitiveInfo};
+
+    std::vector<vk::PipelineShaderStageCreateInfo> shaderStages(4);
     shaderStages[0] = {{},
         vk::ShaderStageFlagBits::eRaygenKHR,
         *shaderModules[0],
-        "main"};
+        "main",
+        &raygenSpecialization};
     shaderStages[1] = {{},
         vk::ShaderStageFlagBits::eMissKHR,
         *shaderModules[1],
         "main"};
     shaderStages[2] = {{},
-        vk::ShaderStageFlagBits::eClosestHitKHR,
+        vk::ShaderStageFlagBits::eMissKHR,
         *shaderModules[2],
         "main"};
+    shaderStages[3] = {{},
+        vk::ShaderStageFlagBits::eClosestHitKHR,
+        *shaderModules[3],
+        "main",
+        &chitSpecialization};
 
-    std::vector<vk::RayTracingShaderGroupCreateInfoKHR> shaderGroups(3);
+    // Miss index 0 is the environment, miss index 1 the shadow ray
+    std::vector<vk::RayTracingShaderGroupCreateInfoKHR> shaderGroups(4);
     shaderGroups[0] = {vk::RayTracingShaderGroupTypeKHR::eGeneral,
         0,
         VK_SHADER_UNUSED_KHR,
@@ -726,10 +3520,15 @@ int run() {
         VK_SHADER_UNUSED_KHR,
         VK_SHADER_UNUSED_KHR,
         VK_SHADER_UNUSED_KHR};
-    shaderGroups[2] = {
+    shaderGroups[2] = {vk::RayTracingShaderGroupTypeKHR::eGeneral,
+        2,
+        VK_SHADER_UNUSED_KHR,
+        VK_SHADER_UNUSED_KHR,
+        VK_SHADER_UNUSED_KHR};
+    shaderGroups[3] = {
         vk::RayTracingShaderGroupTypeKHR::eTrianglesHitGroup,
         VK_SHADER_UNUSED_KHR,
-        2,
+        3,
         VK_SHADER_UNUSED_KHR,
         VK_SHADER_UNUSED_KHR};
 
@@ -742,23 +3541,52 @@ int run() {
         {1,
             vk::DescriptorType::eStorageImage,
             1,
-            vk::ShaderStageFlagBits::eRaygenKHR},  // Binding = 1 : Storage
-                                                   // image
+            vk::ShaderStageFlagBits::eRaygenKHR},  // Binding = 1 :
+                                                   // Sample index
         {2,
             vk::DescriptorType::eStorageBuffer,
             1,
             vk::ShaderStageFlagBits::eClosestHitKHR},  // Binding = 2 :
-                                                       // Vertices
+                                                       // Instances
         {3,
             vk::DescriptorType::eStorageBuffer,
             1,
-            vk::ShaderStageFlagBits::eClosestHitKHR},  // Binding = 3 :
-                                                       // Indices
+            vk::ShaderStageFlagBits::eRaygenKHR},  // Binding = 3 : Ray
+                                                   // counter
         {4,
+            vk::DescriptorType::eStorageImage,
+            1,
+            vk::ShaderStageFlagBits::eRaygenKHR},  // Binding = 4 :
+                                                   // Luminance moments
+        {5,
+            vk::DescriptorType::eStorageImage,
+            1,
+            vk::ShaderStageFlagBits::eRaygenKHR},  // Binding = 5 : Sample
+                                                   // budget
+        {6,
+            vk::DescriptorType::eStorageImage,
+            1,
+            vk::ShaderStageFlagBits::eRaygenKHR},  // Binding = 6 :
+                                                   // Guides
+        {7,
+            vk::DescriptorType::eUniformBuffer,
+            1,
+            vk::ShaderStageFlagBits::eRaygenKHR},  // Binding = 7 : Camera
+        {8,
+            vk::DescriptorType::eStorageImage,
+            1,
+            vk::ShaderStageFlagBits::eRaygenKHR},  // Binding = 8 : Frame
+                                                   // samples
+        {9,
             vk::DescriptorType::eStorageBuffer,
             1,
-            vk::ShaderStageFlagBits::eClosestHitKHR},  // Binding = 4 :
-                                                       // Faces
+            vk::ShaderStageFlagBits::eRaygenKHR},  // Binding = 9 : Batch
+                                                   // cameras
+        {10,
+            vk::DescriptorType::eStorageImage,
+            1,
+            vk::ShaderStageFlagBits::eRaygenKHR},  // Binding = 10 :
+                                                   // Batch views
     };
 
     // Create desc set layout
@@ -770,7 +3598,7 @@ int run() {
     // Create pipeline layout
     vk::PushConstantRange pushRange;
     pushRange.setOffset(0);
-    pushRange.setSize(sizeof(int));
+    pushRange.setSize(sizeof(RaygenPushConstants));
     pushRange.setStageFlags(vk::ShaderStageFlagBits::eRaygenKHR);
 
     vk::PipelineLayoutCreateInfo pipelineLayoutInfo;
@@ -805,11 +3633,14 @@ int run() {
         properties
             .get<vk::PhysicalDeviceRayTracingPipelinePropertiesKHR>();
 
-    // Calculate shader binding table (SBT) size
+    // Calculate shader binding table (SBT) size. Handles come back
+    // tightly packed; records in the SBT use the aligned stride.
     uint32_t handleSize = rtProperties.shaderGroupHandleSize;
-    uint32_t handleSizeAligned = rtProperties.shaderGroupHandleAlignment;
+    uint32_t handleAlignment = rtProperties.shaderGroupHandleAlignment;
+    uint32_t handleSizeAligned =
+        (handleSize + handleAlignment - 1) & ~(handleAlignment - 1);
     uint32_t groupCount = static_cast<uint32_t>(shaderGroups.size());
-    uint32_t sbtSize = groupCount * handleSizeAligned;
+    uint32_t sbtSize = groupCount * handleSize;
 
     // Get shader group handles
     std::vector<uint8_t> handleStorage(sbtSize);
@@ -824,129 +3655,1482 @@ int run() {
     }
 
     // Create SBT
+    const uint32_t missCount = 2;
+    std::vector<uint8_t> missHandles(missCount * handleSizeAligned);
+    for (uint32_t i = 0; i < missCount; i++) {
+        memcpy(missHandles.data() + i * handleSizeAligned,
+            handleStorage.data() + (1 + i) * handleSize,
+            handleSize);
+    }
     Buffer raygenSBT{context,
         Buffer::Type::ShaderBindingTable,
         handleSize,
-        handleStorage.data() + 0 * handleSizeAligned};
+        handleStorage.data() + 0 * handleSize};
     Buffer missSBT{context,
         Buffer::Type::ShaderBindingTable,
-        handleSize,
-        handleStorage.data() + 1 * handleSizeAligned};
+        missHandles.size(),
+        missHandles.data()};
     Buffer hitSBT{context,
         Buffer::Type::ShaderBindingTable,
         handleSize,
-        handleStorage.data() + 2 * handleSizeAligned};
+        handleStorage.data() + 3 * handleSize};
 
-    uint32_t stride = rtProperties.shaderGroupHandleAlignment;
-    uint32_t size = rtProperties.shaderGroupHandleAlignment;
+    uint32_t stride = handleSizeAligned;
+    uint32_t size = handleSizeAligned;
 
     vk::StridedDeviceAddressRegionKHR raygenRegion{raygenSBT.deviceAddress,
         stride,
         size};
     vk::StridedDeviceAddressRegionKHR missRegion{missSBT.deviceAddress,
         stride,
-        size};
+        size * missCount};
     vk::StridedDeviceAddressRegionKHR hitRegion{hitSBT.deviceAddress,
         stride,
         size};
 
     // Create desc set
-    vk::UniqueDescriptorSet descSet =
+    vk::DescriptorSet descSet =
         context.allocateDescSet(*descSetLayout);
     std::vector<vk::WriteDescriptorSet> writes(bindings.size());
     for (int i = 0; i < bindings.size(); i++) {
-        writes[i].setDstSet(*descSet);
+        writes[i].setDstSet(descSet);
         writes[i].setDescriptorType(bindings[i].descriptorType);
         writes[i].setDescriptorCount(bindings[i].descriptorCount);
         writes[i].setDstBinding(bindings[i].binding);
     }
     writes[0].setPNext(&topAccel.descAccelInfo);
-    writes[1].setImageInfo(outputImage.descImageInfo);
-    writes[2].setBufferInfo(vertexBuffer.descBufferInfo);
-    writes[3].setBufferInfo(indexBuffer.descBufferInfo);
-    writes[4].setBufferInfo(faceBuffer.descBufferInfo);
+    writes[1].setImageInfo(sampleIndexImage.descImageInfo);
+    writes[2].setBufferInfo(sceneInstanceBuffer.descBufferInfo);
+    writes[3].setBufferInfo(rayCounterBuffer.descBufferInfo);
+    writes[4].setImageInfo(momentsImage.descImageInfo);
+    writes[5].setImageInfo(budgetImage.descImageInfo);
+    writes[6].setImageInfo(guideImage.descImageInfo);
+    writes[7].setBufferInfo(cameraBuffer.descBufferInfo);
+    writes[8].setImageInfo(sampleImage.descImageInfo);
+    writes[9].setBufferInfo(viewBuffer.descBufferInfo);
+    writes[10].setImageInfo(viewImage.descImageInfo);
     context.device->updateDescriptorSets(writes, nullptr);
 
+    // Create resolve pass
+    ComputePass resolvePass{context,
+        "./shaders/resolve.comp.spv",
+        {
+            {0,
+                vk::DescriptorType::eStorageImage,
+                1,
+                vk::ShaderStageFlagBits::eCompute},  // Accumulation
+            {1,
+                vk::DescriptorType::eStorageImage,
+                1,
+                vk::ShaderStageFlagBits::eCompute},  // Display image
+        },
+        sizeof(ResolvePushConstants)};
+    // Per target, one set resolves the accumulation and the other the
+    // denoiser output. Targets are the swapchain images on the compute
+    // path, or the display image.
+    const Image& denoisedImage =
+        *denoiseImages[(kDenoiseIterations - 1) % 2];
+    std::vector<vk::DescriptorImageInfo> resolveTargets;
+    if (computePresent) {
+        for (const vk::UniqueImageView& view : swapchainViews) {
+            resolveTargets.push_back(
+                {{}, *view, vk::ImageLayout::eGeneral});
+        }
+    } else {
+        resolveTargets.push_back(graph.image(output).descImageInfo);
+    }
+    std::vector<vk::DescriptorSet> resolveDescSets;
+    for (const vk::DescriptorImageInfo& target : resolveTargets) {
+        for (const Image* source : {&accumImage, &denoisedImage}) {
+            vk::DescriptorSet& resolveDescSet =
+                resolveDescSets.emplace_back(
+                    context.allocateDescSet(*resolvePass.descSetLayout));
+            std::vector<vk::WriteDescriptorSet> resolveWrites(2);
+            for (uint32_t i = 0; i < resolveWrites.size(); i++) {
+                resolveWrites[i].setDstSet(resolveDescSet);
+                resolveWrites[i].setDstBinding(i);
+                resolveWrites[i].setDescriptorType(
+                    vk::DescriptorType::eStorageImage);
+            }
+            resolveWrites[0].setImageInfo(source->descImageInfo);
+            resolveWrites[1].setImageInfo(target);
+            context.device->updateDescriptorSets(resolveWrites, nullptr);
+        }
+    }
+    const vk::Extent2D resolveExtent =
+        computePresent ? windowExtent : vk::Extent2D{WIDTH, HEIGHT};
+
+    // Create reprojection pass
+    ComputePass reprojectPass{context,
+        "./shaders/reproject.comp.spv",
+        {
+            {0,
+                vk::DescriptorType::eStorageImage,
+                1,
+                vk::ShaderStageFlagBits::eCompute},  // Frame samples
+            {1,
+                vk::DescriptorType::eStorageImage,
+                1,
+                vk::ShaderStageFlagBits::eCompute},  // Guides
+            {2,
+                vk::DescriptorType::eStorageImage,
+                1,
+                vk::ShaderStageFlagBits::eCompute},  // History accum
+            {3,
+                vk::DescriptorType::eStorageImage,
+                1,
+                vk::ShaderStageFlagBits::eCompute},  // History moments
+            {4,
+                vk::DescriptorType::eStorageImage,
+                1,
+                vk::ShaderStageFlagBits::eCompute},  // History guides
+            {5,
+                vk::DescriptorType::eStorageImage,
+                1,
+                vk::ShaderStageFlagBits::eCompute},  // Accumulation
+            {6,
+                vk::DescriptorType::eStorageImage,
+                1,
+                vk::ShaderStageFlagBits::eCompute},  // Luminance moments
+        },
+        sizeof(ReprojectPushConstants)};
+    vk::DescriptorSet reprojectDescSet =
+        context.allocateDescSet(*reprojectPass.descSetLayout);
+    const Image* reprojectImages[] = {&sampleImage,
+        &guideImage,
+        &historyAccumImage,
+        &historyMomentsImage,
+        &historyGuideImage,
+        &accumImage,
+        &momentsImage};
+    std::vector<vk::WriteDescriptorSet> reprojectWrites(7);
+    for (uint32_t i = 0; i < reprojectWrites.size(); i++) {
+        reprojectWrites[i].setDstSet(reprojectDescSet);
+        reprojectWrites[i].setDstBinding(i);
+        reprojectWrites[i].setDescriptorType(
+            vk::DescriptorType::eStorageImage);
+        reprojectWrites[i].setImageInfo(reprojectImages[i]->descImageInfo);
+    }
+    context.device->updateDescriptorSets(reprojectWrites, nullptr);
+
+    // Create ReSTIR reuse pass
+    ComputePass restirPass{context,
+        "./shaders/restir.comp.spv",
+        {
+            {0,
+                vk::DescriptorType::eStorageImage,
+                1,
+                vk::ShaderStageFlagBits::eCompute},  // Guides
+            {1,
+                vk::DescriptorType::eStorageImage,
+                1,
+                vk::ShaderStageFlagBits::eCompute},  // History guides
+        },
+        sizeof(RestirPushConstants)};
+    vk::DescriptorSet restirDescSet =
+        context.allocateDescSet(*restirPass.descSetLayout);
+    std::vector<vk::WriteDescriptorSet> restirWrites(2);
+    for (uint32_t i = 0; i < restirWrites.size(); i++) {
+        restirWrites[i].setDstSet(restirDescSet);
+        restirWrites[i].setDstBinding(i);
+        restirWrites[i].setDescriptorType(
+            vk::DescriptorType::eStorageImage);
+    }
+    restirWrites[0].setImageInfo(guideImage.descImageInfo);
+    restirWrites[1].setImageInfo(historyGuideImage.descImageInfo);
+    context.device->updateDescriptorSets(restirWrites, nullptr);
+
+    RestirPushConstants restirConstants{};
+    restirConstants.candidates = candidateReservoirBuffer.deviceAddress;
+    restirConstants.reservoirs = reservoirBuffer.deviceAddress;
+    restirConstants.lightTriangles = lights.triangleBuffer.deviceAddress;
+
+    // Create denoiser pass. Set i writes denoiseImages[i] and reads the
+    // other one; the first iteration reads the accumulation instead.
+    ComputePass atrousPass{context,
+        "./shaders/atrous.comp.spv",
+        {
+            {0,
+                vk::DescriptorType::eStorageImage,
+                1,
+                vk::ShaderStageFlagBits::eCompute},  // Accumulation
+            {1,
+                vk::DescriptorType::eStorageImage,
+                1,
+                vk::ShaderStageFlagBits::eCompute},  // Luminance moments
+            {2,
+                vk::DescriptorType::eStorageImage,
+                1,
+                vk::ShaderStageFlagBits::eCompute},  // Guides
+            {3,
+                vk::DescriptorType::eStorageImage,
+                1,
+                vk::ShaderStageFlagBits::eCompute},  // Input
+            {4,
+                vk::DescriptorType::eStorageImage,
+                1,
+                vk::ShaderStageFlagBits::eCompute},  // Output
+        },
+        sizeof(AtrousPushConstants)};
+    vk::DescriptorSet atrousDescSets[2];
+    for (uint32_t i = 0; i < 2; i++) {
+        atrousDescSets[i] =
+            context.allocateDescSet(*atrousPass.descSetLayout);
+        const Image* atrousImages[] = {&accumImage,
+            &momentsImage,
+            &guideImage,
+            denoiseImages[1 - i],
+            denoiseImages[i]};
+        std::vector<vk::WriteDescriptorSet> atrousWrites(5);
+        for (uint32_t j = 0; j < atrousWrites.size(); j++) {
+            atrousWrites[j].setDstSet(atrousDescSets[i]);
+            atrousWrites[j].setDstBinding(j);
+            atrousWrites[j].setDescriptorType(
+                vk::DescriptorType::eStorageImage);
+            atrousWrites[j].setImageInfo(atrousImages[j]->descImageInfo);
+        }
+        context.device->updateDescriptorSets(atrousWrites, nullptr);
+    }
+
+    // Create adaptive sampling pass
+    ComputePass adaptivePass{context,
+        "./shaders/adaptive.comp.spv",
+        {
+            {0,
+                vk::DescriptorType::eStorageImage,
+                1,
+                vk::ShaderStageFlagBits::eCompute},  // Accumulation
+            {1,
+                vk::DescriptorType::eStorageImage,
+                1,
+                vk::ShaderStageFlagBits::eCompute},  // Luminance moments
+            {2,
+                vk::DescriptorType::eStorageImage,
+                1,
+                vk::ShaderStageFlagBits::eCompute},  // Sample budget
+        },
+        sizeof(AdaptivePushConstants)};
+    vk::DescriptorSet adaptiveDescSet =
+        context.allocateDescSet(*adaptivePass.descSetLayout);
+    const Image* adaptiveImages[] = {&accumImage,
+        &momentsImage,
+        &budgetImage};
+    std::vector<vk::WriteDescriptorSet> adaptiveWrites(3);
+    for (uint32_t i = 0; i < adaptiveWrites.size(); i++) {
+        adaptiveWrites[i].setDstSet(adaptiveDescSet);
+        adaptiveWrites[i].setDstBinding(i);
+        adaptiveWrites[i].setDescriptorType(
+            vk::DescriptorType::eStorageImage);
+        adaptiveWrites[i].setImageInfo(adaptiveImages[i]->descImageInfo);
+    }
+    context.device->updateDescriptorSets(adaptiveWrites, nullptr);
+
+    // Create wavefront path tracer stages. They share the raygen
+    // specialization for the sampling mode and Russian roulette depth.
+    ComputePass wavefrontPass{context,
+        "./shaders/wavefront.comp.spv",
+        {
+            {0,
+                vk::DescriptorType::eStorageImage,
+                1,
+                vk::ShaderStageFlagBits::eCompute},  // Accumulation
+            {1,
+                vk::DescriptorType::eStorageImage,
+                1,
+                vk::ShaderStageFlagBits::eCompute},  // Luminance moments
+            {2,
+                vk::DescriptorType::eStorageImage,
+                1,
+                vk::ShaderStageFlagBits::eCompute},  // Guides
+            {3,
+                vk::DescriptorType::eUniformBuffer,
+                1,
+                vk::ShaderStageFlagBits::eCompute},  // Camera
+            {4,
+                vk::DescriptorType::eStorageImage,
+                1,
+                vk::ShaderStageFlagBits::eCompute},  // Frame samples
+        },
+        sizeof(WavefrontPushConstants),
+        &raygenSpecialization};
+    vk::DescriptorSet wavefrontDescSet =
+        context.allocateDescSet(*wavefrontPass.descSetLayout);
+    const Image* wavefrontImages[] = {&accumImage,
+        &momentsImage,
+        &guideImage,
+        nullptr,
+        &sampleImage};
+    std::vector<vk::WriteDescriptorSet> wavefrontWrites(5);
+    for (uint32_t i = 0; i < wavefrontWrites.size(); i++) {
+        wavefrontWrites[i].setDstSet(wavefrontDescSet);
+        wavefrontWrites[i].setDstBinding(i);
+        if (wavefrontImages[i]) {
+            wavefrontWrites[i].setDescriptorType(
+                vk::DescriptorType::eStorageImage);
+            wavefrontWrites[i].setImageInfo(
+                wavefrontImages[i]->descImageInfo);
+        }
+    }
+    wavefrontWrites[3].setDescriptorType(
+        vk::DescriptorType::eUniformBuffer);
+    wavefrontWrites[3].setBufferInfo(cameraBuffer.descBufferInfo);
+    context.device->updateDescriptorSets(wavefrontWrites, nullptr);
+
+    // Create the ray query backend of the wavefront trace passes
+    struct RayQuerySpecialization {
+        vk::Bool32 countRays = kCountRays;
+        vk::Bool32 usePrimitiveInfo = kUsePrimitiveInfo;
+    } rayQueryConstants;
+    std::vector<vk::SpecializationMapEntry> rayQueryEntries{
+        {0,
+            offsetof(RayQuerySpecialization, countRays),
+            sizeof(vk::Bool32)},
+        {1,
+            offsetof(RayQuerySpecialization, usePrimitiveInfo),
+            sizeof(vk::Bool32)},
+    };
+    vk::SpecializationInfo rayQuerySpecialization{
+        static_cast<uint32_t>(rayQueryEntries.size()),
+        rayQueryEntries.data(),
+        sizeof(RayQuerySpecialization),
+        &rayQueryConstants};
+    ComputePass rayQueryPass{context,
+        "./shaders/rayquery.comp.spv",
+        {
+            {0,
+                vk::DescriptorType::eAccelerationStructureKHR,
+                1,
+                vk::ShaderStageFlagBits::eCompute},  // TLAS
+            {1,
+                vk::DescriptorType::eStorageBuffer,
+                1,
+                vk::ShaderStageFlagBits::eCompute},  // Instances
+            {2,
+                vk::DescriptorType::eStorageBuffer,
+                1,
+                vk::ShaderStageFlagBits::eCompute},  // Ray counter
+        },
+        sizeof(RayQueryPushConstants),
+        &rayQuerySpecialization};
+    vk::DescriptorSet rayQueryDescSet =
+        context.allocateDescSet(*rayQueryPass.descSetLayout);
+    std::vector<vk::WriteDescriptorSet> rayQueryWrites(3);
+    for (uint32_t i = 0; i < rayQueryWrites.size(); i++) {
+        rayQueryWrites[i].setDstSet(rayQueryDescSet);
+        rayQueryWrites[i].setDstBinding(i);
+        rayQueryWrites[i].setDescriptorCount(1);
+        rayQueryWrites[i].setDescriptorType(
+            vk::DescriptorType::eStorageBuffer);
+    }
+    rayQueryWrites[0].setDescriptorType(
+        vk::DescriptorType::eAccelerationStructureKHR);
+    rayQueryWrites[0].setPNext(&topAccel.descAccelInfo);
+    rayQueryWrites[1].setBufferInfo(sceneInstanceBuffer.descBufferInfo);
+    rayQueryWrites[2].setBufferInfo(rayCounterBuffer.descBufferInfo);
+    context.device->updateDescriptorSets(rayQueryWrites, nullptr);
+
+    AdaptivePushConstants adaptiveConstants{};
+    adaptiveConstants.activePixels = activePixelBuffer.deviceAddress;
+    adaptiveConstants.launchArgs = launchArgsBuffer.deviceAddress;
+    adaptiveConstants.errorThreshold = kAdaptiveErrorThreshold;
+    adaptiveConstants.samplesPerLaunch = kSamplesPerLaunch;
+    adaptiveConstants.maxSamples = kAdaptiveMaxSamples;
+
     // Main loop
     uint32_t imageIndex = 0;
+    // Images are allocated at WIDTH x HEIGHT; with dynamic resolution
+    // the passes work on the top-left renderExtent of them
+    vk::Extent2D renderExtent{WIDTH, HEIGHT};
+    // Extent of the last frame that reprojected, which its history and
+    // reservoirs are laid out at
+    vk::Extent2D historyExtent{WIDTH, HEIGHT};
     int frame = 0;
-    vk::UniqueSemaphore imageAcquiredSemaphore =
-        context.device->createSemaphoreUnique(vk::SemaphoreCreateInfo());
-    while (!glfwWindowShouldClose(context.window)) {
-        glfwPollEvents();
+    RaygenPushConstants pushConstants{};
+    pushConstants.lightCount = lights.count;
+    pushConstants.lightArea = lights.totalArea;
+    pushConstants.flags = RaygenFlags::NextEventEstimation
+                          | RaygenFlags::LowDiscrepancySampler;
+    pushConstants.lightTriangles = lights.triangleBuffer.deviceAddress;
+    pushConstants.lightAliasTable = lights.aliasBuffer.deviceAddress;
+    pushConstants.sobolDirections = samplerTables.sobolBuffer.deviceAddress;
+    pushConstants.blueNoise = samplerTables.blueNoiseBuffer.deviceAddress;
+    pushConstants.activePixels = activePixelBuffer.deviceAddress;
+    pushConstants.samplesPerLaunch = kSamplesPerLaunch;
+    pushConstants.candidateReservoirs =
+        candidateReservoirBuffer.deviceAddress;
+    pushConstants.reservoirs = reservoirBuffer.deviceAddress;
+    pushConstants.environmentTexels =
+        environment.texelBuffer.deviceAddress;
+    pushConstants.environmentAliasTable =
+        environment.aliasBuffer.deviceAddress;
+    pushConstants.environmentWidth = environment.width;
+    pushConstants.environmentHeight = environment.height;
+    pushConstants.environmentWeightScale = environment.weightScale;
+    pushConstants.wavefront = wavefrontStateBuffer.deviceAddress;
 
-        // Acquire next image
-        imageIndex = context.device
-                         ->acquireNextImageKHR(*swapchain,
-                             UINT64_MAX,
-                             *imageAcquiredSemaphore)
-                         .value;
+    WavefrontPushConstants wavefrontConstants{};
+    wavefrontConstants.lightCount = pushConstants.lightCount;
+    wavefrontConstants.lightArea = pushConstants.lightArea;
+    wavefrontConstants.lightTriangles = pushConstants.lightTriangles;
+    wavefrontConstants.lightAliasTable = pushConstants.lightAliasTable;
+    wavefrontConstants.sobolDirections = pushConstants.sobolDirections;
+    wavefrontConstants.blueNoise = pushConstants.blueNoise;
+    wavefrontConstants.environmentTexels =
+        pushConstants.environmentTexels;
+    wavefrontConstants.environmentAliasTable =
+        pushConstants.environmentAliasTable;
+    wavefrontConstants.wavefront = pushConstants.wavefront;
+    wavefrontConstants.environmentWidth = pushConstants.environmentWidth;
+    wavefrontConstants.environmentHeight =
+        pushConstants.environmentHeight;
+    wavefrontConstants.environmentWeightScale =
+        pushConstants.environmentWeightScale;
 
-        // Record commands
-        vk::CommandBuffer commandBuffer = *commandBuffers[imageIndex];
-        commandBuffer.begin(vk::CommandBufferBeginInfo());
+    // Backends of the two trace passes, switched independently
+    TraceBackend extendBackend = TraceBackend::Pipeline;
+    TraceBackend shadowBackend = TraceBackend::Pipeline;
+
+    // Every sample of the launch is one path per pixel, and every bounce
+    // of it separate launches that talk through the queues: extension
+    // trace, material sort, shade, shadow trace. The traces run the
+    // raygen pipeline over the queue, the rest is wavefront.comp.
+    auto traceWavefront = [&](vk::CommandBuffer commandBuffer) {
+        // Later stages read earlier writes, some as indirect arguments
+        auto stageBarrier = [&]() {
+            memoryBarrier(commandBuffer,
+                vk::PipelineStageFlagBits::eComputeShader
+                    | vk::PipelineStageFlagBits::eRayTracingShaderKHR,
+                vk::PipelineStageFlagBits::eComputeShader
+                    | vk::PipelineStageFlagBits::eRayTracingShaderKHR
+                    | vk::PipelineStageFlagBits::eDrawIndirect,
+                vk::AccessFlagBits::eShaderRead
+                    | vk::AccessFlagBits::eShaderWrite
+                    | vk::AccessFlagBits::eIndirectCommandRead);
+        };
+        RaygenPushConstants traceConstants = pushConstants;
+        traceConstants.frame = frame;
+        auto traceQueue = [&](RaygenFlags flag, vk::DeviceSize offset) {
+            const bool extend = flag == RaygenFlags::WavefrontExtend;
+            const TraceBackend backend =
+                extend ? extendBackend : shadowBackend;
+            if (backend == TraceBackend::RayQuery) {
+                RayQueryPushConstants queryConstants{};
+                queryConstants.wavefront =
+                    wavefrontStateBuffer.deviceAddress;
+                queryConstants.pass =
+                    extend ? RayQueryExtend : RayQueryShadow;
+                queryConstants.bounce = traceConstants.bounce;
+                rayQueryPass.dispatchIndirect(commandBuffer,
+                    rayQueryDescSet,
+                    *wavefrontStateBuffer.buffer,
+                    offset + offsetof(QueueCounter, groups),
+                    &queryConstants,
+                    sizeof(RayQueryPushConstants));
+                return;
+            }
+            traceConstants.flags = pushConstants.flags | flag;
+            commandBuffer.pushConstants(*pipelineLayout,
+                vk::ShaderStageFlagBits::eRaygenKHR,
+                0,
+                sizeof(RaygenPushConstants),
+                &traceConstants);
+            commandBuffer.traceRaysIndirectKHR(raygenRegion,
+                missRegion,
+                hitRegion,
+                {},
+                wavefrontStateBuffer.deviceAddress + offset
+                    + offsetof(QueueCounter, launch));
+        };
+        auto runStage = [&](WavefrontStage stage) {
+            wavefrontConstants.stage = stage;
+            wavefrontPass.dispatch(commandBuffer,
+                wavefrontDescSet,
+                stage == WavefrontPrefix ? 1 : renderExtent.width,
+                stage == WavefrontPrefix ? 1 : renderExtent.height,
+                &wavefrontConstants,
+                sizeof(WavefrontPushConstants));
+        };
+        auto queueStage = [&](WavefrontStage stage, vk::DeviceSize queue) {
+            wavefrontConstants.stage = stage;
+            wavefrontPass.dispatchIndirect(commandBuffer,
+                wavefrontDescSet,
+                *wavefrontStateBuffer.buffer,
+                queue + offsetof(QueueCounter, groups),
+                &wavefrontConstants,
+                sizeof(WavefrontPushConstants));
+        };
+
+        commandBuffer.bindPipeline(vk::PipelineBindPoint::eRayTracingKHR,
+            *pipeline);
+        commandBuffer.bindDescriptorSets(
+            vk::PipelineBindPoint::eRayTracingKHR,
+            *pipelineLayout,
+            0,
+            descSet,
+            nullptr);
+        wavefrontConstants.flags = pushConstants.flags;
+        wavefrontConstants.frame = frame;
+        const uint32_t waves = pushConstants.samplesPerLaunch;
+        for (uint32_t wave = 0; wave < waves; wave++) {
+            wavefrontConstants.wave = wave;
+            runStage(WavefrontGenerate);
+            stageBarrier();
+            for (uint32_t bounce = 0; bounce < kMaxPathDepth; bounce++) {
+                const vk::DeviceSize rayCounter =
+                    offsetof(WavefrontState, rayCounters)
+                    + (bounce % 2) * sizeof(QueueCounter);
+                wavefrontConstants.bounce = bounce;
+                traceConstants.bounce = bounce;
+                traceQueue(RaygenFlags::WavefrontExtend, rayCounter);
+                stageBarrier();
+
+                // Counting sort by material, then shade in that order
+                queueStage(WavefrontHistogram, rayCounter);
+                stageBarrier();
+                runStage(WavefrontPrefix);
+                stageBarrier();
+                queueStage(WavefrontScatter, rayCounter);
+                stageBarrier();
+                queueStage(WavefrontShade, rayCounter);
+                stageBarrier();
+
+                traceQueue(RaygenFlags::WavefrontShadow,
+                    offsetof(WavefrontState, shadowCounter));
+                stageBarrier();
+            }
+            runStage(WavefrontAccumulate);
+            stageBarrier();
+        }
+    };
+
+    bool neeKeyDown = false;
+    bool samplerKeyDown = false;
+    bool adaptiveKeyDown = false;
+    bool denoiseKeyDown = false;
+    bool restirKeyDown = false;
+    bool wavefrontKeyDown = false;
+    bool extendBackendKeyDown = false;
+    bool shadowBackendKeyDown = false;
+    bool barrierKeyDown = false;
+    bool resolutionKeyDown = false;
+    bool tiledKeyDown = false;
+    bool recordingKeyDown = false;
+    bool denoise = false;
+    bool wavefront = false;
+    std::vector<double> denoiseMilliseconds(kDenoiseIterations, 0.0);
+    bool adaptiveSampling = true;
+    bool converged = false;
+    // Frames since the camera last moved; adaptive launches only trace
+    // part of the image, so they wait until every guide is current.
+    int staticFrames = 0;
+    // Frames since the camera last moved, not reset by restarts
+    int stillFrames = 0;
+    bool dynamicResolution = false;
+    ResolutionController resolution;
+    // Tiled tracing walks the tiles in scanline order, as many per frame
+    // as fit the budget
+    bool tiledTracing = false;
+    uint32_t tileCursor = 0;
+    uint32_t tilesPerFrame = 1;
+    auto accumulationStart = std::chrono::steady_clock::now();
+    // Bumped whenever convergence is reset, so frames still in flight
+    // from before cannot report it
+    uint32_t convergenceEpoch = 0;
+    auto restartAccumulation = [&]() {
+        convergenceEpoch++;
+        frame = 0;
+        staticFrames = 0;
+        tileCursor = 0;
+        converged = false;
+        accumulationStart = std::chrono::steady_clock::now();
+    };
+    glm::mat4 prevViewProj = camera.viewProj();
+    auto lastFrameTime = std::chrono::steady_clock::now();
+    double traceMilliseconds = 0.0;
+    uint64_t tracedRays = 0;
+    double presentMilliseconds = 0.0;
+    uint64_t frameBarriers = 0;
+    double recordMilliseconds = 0.0;
+    // The passes record into secondaries across the job system's
+    // threads, from pools per frame in flight
+    engine_jobs::JobSystem jobs;
+    engine_init::FrameCommandPools framePools(*context.device,
+        context.queueFamilyIndex,
+        kFramesInFlight,
+        jobs.thread_count());
+    bool parallelRecording = true;
+    // Set every frame, read by the pass bodies
+    bool restir = false;
+    bool adaptiveLaunch = false;
+    bool tiledLaunch = false;
+    uint32_t tilesTraced = 0;
+
+    graph.passes[historyNode].record =
+        [&](vk::CommandBuffer commandBuffer) {
+            Image::copyImage(commandBuffer,
+                *accumImage.image,
+                *historyAccumImage.image,
+                vk::ImageLayout::eGeneral,
+                vk::ImageLayout::eGeneral);
+            Image::copyImage(commandBuffer,
+                *momentsImage.image,
+                *historyMomentsImage.image,
+                vk::ImageLayout::eGeneral,
+                vk::ImageLayout::eGeneral);
+            Image::copyImage(commandBuffer,
+                *guideImage.image,
+                *historyGuideImage.image,
+                vk::ImageLayout::eGeneral,
+                vk::ImageLayout::eGeneral);
+            commandBuffer.clearColorImage(*sampleImage.image,
+                vk::ImageLayout::eGeneral,
+                vk::ClearColorValue(std::array{0.0f, 0.0f, 0.0f, 0.0f}),
+                vk::ImageSubresourceRange{
+                    vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1});
+        };
+
+    // Compact the pixels still above the error target into the list the
+    // next launch runs over
+    graph.passes[adaptiveNode].record =
+        [&](vk::CommandBuffer commandBuffer) {
+            const vk::TraceRaysIndirectCommandKHR emptyLaunch{0, 1, 1};
+            commandBuffer.updateBuffer(*launchArgsBuffer.buffer,
+                0,
+                sizeof(emptyLaunch),
+                &emptyLaunch);
+            memoryBarrier(commandBuffer,
+                vk::PipelineStageFlagBits::eTransfer,
+                vk::PipelineStageFlagBits::eComputeShader,
+                vk::AccessFlagBits::eShaderRead
+                    | vk::AccessFlagBits::eShaderWrite,
+                vk::AccessFlagBits::eTransferWrite);
+            adaptiveConstants.renderWidth = renderExtent.width;
+            adaptiveConstants.renderHeight = renderExtent.height;
+            adaptivePass.dispatch(commandBuffer,
+                adaptiveDescSet,
+                renderExtent.width,
+                renderExtent.height,
+                &adaptiveConstants,
+                sizeof(AdaptivePushConstants));
+        };
+
+    graph.passes[traceNode].record = [&](vk::CommandBuffer commandBuffer) {
+        if (wavefront) {
+            traceWavefront(commandBuffer);
+            return;
+        }
         commandBuffer.bindPipeline(vk::PipelineBindPoint::eRayTracingKHR,
             *pipeline);
         commandBuffer.bindDescriptorSets(
             vk::PipelineBindPoint::eRayTracingKHR,
             *pipelineLayout,
             0,
-            *descSet,
+            descSet,
             nullptr);
+        if (tiledLaunch) {
+            // One launch per tile, its offset in the push constants
+            const vk::Extent2D grid = tileGrid(renderExtent);
+            RaygenPushConstants tileConstants = pushConstants;
+            // No ReSTIR pass runs in tiled mode, so the primary hit has
+            // to take its direct light from the path itself
+            tileConstants.flags &= ~RaygenFlags::Restir;
+            for (uint32_t i = 0; i < tilesTraced; i++) {
+                const uint32_t tile =
+                    (tileCursor + i) % (grid.width * grid.height);
+                const uint32_t x = tile % grid.width * kTraceTileSize;
+                const uint32_t y = tile / grid.width * kTraceTileSize;
+                tileConstants.tileOffset = x | y << 16;
+                commandBuffer.pushConstants(*pipelineLayout,
+                    vk::ShaderStageFlagBits::eRaygenKHR,
+                    0,
+                    sizeof(RaygenPushConstants),
+                    &tileConstants);
+                commandBuffer.traceRaysKHR(raygenRegion,
+                    missRegion,
+                    hitRegion,
+                    {},
+                    std::min(kTraceTileSize, renderExtent.width - x),
+                    std::min(kTraceTileSize, renderExtent.height - y),
+                    1);
+            }
+            return;
+        }
         commandBuffer.pushConstants(*pipelineLayout,
             vk::ShaderStageFlagBits::eRaygenKHR,
             0,
-            sizeof(int),
-            &frame);
-        commandBuffer.traceRaysKHR(raygenRegion,
-            missRegion,
-            hitRegion,
+            sizeof(RaygenPushConstants),
+            &pushConstants);
+        if (adaptiveLaunch) {
+            commandBuffer.traceRaysIndirectKHR(raygenRegion,
+                missRegion,
+                hitRegion,
+                {},
+                launchArgsBuffer.deviceAddress);
+        } else {
+            commandBuffer.traceRaysKHR(raygenRegion,
+                missRegion,
+                hitRegion,
+                {},
+                renderExtent.width,
+                renderExtent.height,
+                1);
+        }
+    };
+
+    // Temporal and spatial reservoir reuse, then one shadow ray per pixel
+    // for the selected light sample
+    graph.passes[restirNode].record =
+        [&](vk::CommandBuffer commandBuffer) {
+            restirConstants.frame = frame;
+            restirConstants.renderWidth = renderExtent.width;
+            restirConstants.renderHeight = renderExtent.height;
+            restirConstants.historyWidth = historyExtent.width;
+            restirConstants.historyHeight = historyExtent.height;
+            for (RestirStage stage : {RestirTemporal, RestirSpatial}) {
+                restirConstants.pass = stage;
+                restirPass.dispatch(commandBuffer,
+                    restirDescSet,
+                    renderExtent.width,
+                    renderExtent.height,
+                    &restirConstants,
+                    sizeof(RestirPushConstants));
+                memoryBarrier(commandBuffer,
+                    vk::PipelineStageFlagBits::eComputeShader,
+                    vk::PipelineStageFlagBits::eComputeShader
+                        | vk::PipelineStageFlagBits::eRayTracingShaderKHR);
+            }
+            RaygenPushConstants shadeConstants = pushConstants;
+            shadeConstants.flags |= RaygenFlags::RestirShade;
+            // Bound again, as the pass may be recorded apart from the
+            // trace pass
+            commandBuffer.bindPipeline(
+                vk::PipelineBindPoint::eRayTracingKHR,
+                *pipeline);
+            commandBuffer.bindDescriptorSets(
+                vk::PipelineBindPoint::eRayTracingKHR,
+                *pipelineLayout,
+                0,
+                descSet,
+                nullptr);
+            commandBuffer.pushConstants(*pipelineLayout,
+                vk::ShaderStageFlagBits::eRaygenKHR,
+                0,
+                sizeof(RaygenPushConstants),
+                &shadeConstants);
+            commandBuffer.traceRaysKHR(raygenRegion,
+                missRegion,
+                hitRegion,
+                {},
+                renderExtent.width,
+                renderExtent.height,
+                1);
+        };
+
+    // Blend the new samples into the reprojected history
+    graph.passes[reprojectNode].record =
+        [&](vk::CommandBuffer commandBuffer) {
+            ReprojectPushConstants reprojectConstants{};
+            reprojectConstants.flags =
+                frame == 0 ? ReprojectFlags::ResetHistory : 0;
+            if (tiledLaunch) {
+                reprojectConstants.flags |= ReprojectFlags::StillCamera;
+            }
+            reprojectConstants.renderWidth = renderExtent.width;
+            reprojectConstants.renderHeight = renderExtent.height;
+            reprojectConstants.historyWidth = historyExtent.width;
+            reprojectConstants.historyHeight = historyExtent.height;
+            reprojectPass.dispatch(commandBuffer,
+                reprojectDescSet,
+                renderExtent.width,
+                renderExtent.height,
+                &reprojectConstants,
+                sizeof(ReprojectPushConstants));
+        };
+
+    // Edge-avoiding a-trous filter over the accumulation
+    for (uint32_t i = 0; i < kDenoiseIterations; i++) {
+        graph.passes[atrousNodes[i]].record =
+            [&, i](vk::CommandBuffer commandBuffer) {
+                AtrousPushConstants atrousConstants{};
+                atrousConstants.stepSize = 1 << i;
+                atrousConstants.flags =
+                    i == 0 ? AtrousFlags::FirstIteration : 0;
+                atrousConstants.renderWidth = renderExtent.width;
+                atrousConstants.renderHeight = renderExtent.height;
+                atrousPass.dispatch(commandBuffer,
+                    atrousDescSets[i % 2],
+                    renderExtent.width,
+                    renderExtent.height,
+                    &atrousConstants,
+                    sizeof(AtrousPushConstants));
+            };
+    }
+
+    graph.passes[resolveNode].record =
+        [&](vk::CommandBuffer commandBuffer) {
+            // Upscales the render extent of the accumulation to the
+            // whole target
+            const uint32_t target = computePresent ? imageIndex : 0;
+            const ResolvePushConstants resolveConstants{
+                renderExtent.width,
+                renderExtent.height};
+            resolvePass.dispatch(commandBuffer,
+                resolveDescSets[target * 2 + (denoise ? 1 : 0)],
+                resolveExtent.width,
+                resolveExtent.height,
+                &resolveConstants,
+                sizeof(ResolvePushConstants));
+        };
+
+    if (copyNode != RenderGraph::kNone) {
+        graph.passes[copyNode].record =
+            [&](vk::CommandBuffer commandBuffer) {
+                const vk::Image outputImage = *graph.image(output).image;
+                if (presentPath == PresentPath::Blit) {
+                    Image::blitImage(commandBuffer,
+                        outputImage,
+                        {WIDTH, HEIGHT},
+                        swapchainImages[imageIndex],
+                        windowExtent);
+                } else {
+                    Image::copyImage(commandBuffer,
+                        outputImage,
+                        swapchainImages[imageIndex]);
+                }
+            };
+    }
+    // Frames in flight. A slot is recorded again once the timeline
+    // passed its last frame, whose results are read back then.
+    struct FrameSlot {
+        vk::UniqueCommandBuffer commandBuffer;
+        vk::UniqueSemaphore imageAcquired;
+        Ticket ticket;
+        bool pending = false;
+        // What the frame was recorded with
+        bool traced = false;
+        bool adaptiveLaunch = false;
+        bool scaling = false;
+        uint32_t tilesTraced = 0;
+        uint32_t tileCount = 0;
+        uint32_t epoch = 0;
+    };
+    std::vector<FrameSlot> frameSlots(kFramesInFlight);
+    if (!headless) {
+        vk::CommandBufferAllocateInfo commandBufferInfo;
+        commandBufferInfo.setCommandPool(*context.commandPool);
+        commandBufferInfo.setCommandBufferCount(kFramesInFlight);
+        std::vector<vk::UniqueCommandBuffer> commandBuffers =
+            context.device->allocateCommandBuffersUnique(
+                commandBufferInfo);
+        for (uint32_t i = 0; i < kFramesInFlight; i++) {
+            frameSlots[i].commandBuffer = std::move(commandBuffers[i]);
+            frameSlots[i].imageAcquired =
+                context.device->createSemaphoreUnique({});
+        }
+    }
+    uint64_t submittedFrames = 0;
+    // Stages of the frame that read the camera and write the counters
+    const vk::PipelineStageFlags frameStages =
+        vk::PipelineStageFlagBits::eRayTracingShaderKHR
+        | vk::PipelineStageFlagBits::eComputeShader;
+
+    // Headless batch: one launch per round of samples covers every view,
+    // the launch depth selecting the camera record and output layer, so
+    // the pipeline bind and launch cost is shared by all views
+    if (batchViews > 0) {
+        RaygenPushConstants batchConstants = pushConstants;
+        batchConstants.flags |= RaygenFlags::MultiView;
+        const auto batchStart = std::chrono::steady_clock::now();
+        const uint32_t launches =
+            (kBatchSamples + kSamplesPerLaunch - 1) / kSamplesPerLaunch;
+        Ticket traced;
+        for (uint32_t launch = 0; launch < launches; launch++) {
+            batchConstants.frame = static_cast<int>(launch);
+            traced = context.submit([&](vk::CommandBuffer commandBuffer) {
+                commandBuffer.bindPipeline(
+                    vk::PipelineBindPoint::eRayTracingKHR,
+                    *pipeline);
+                commandBuffer.bindDescriptorSets(
+                    vk::PipelineBindPoint::eRayTracingKHR,
+                    *pipelineLayout,
+                    0,
+                    descSet,
+                    nullptr);
+                commandBuffer.pushConstants(*pipelineLayout,
+                    vk::ShaderStageFlagBits::eRaygenKHR,
+                    0,
+                    sizeof(RaygenPushConstants),
+                    &batchConstants);
+                commandBuffer.traceRaysKHR(raygenRegion,
+                    missRegion,
+                    hitRegion,
+                    {},
+                    WIDTH,
+                    HEIGHT,
+                    batchViews);
+            });
+        }
+        context.submitter->wait(traced);
+        std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - batchStart;
+        std::cout << "Batch: " << batchViews << " views at "
+                  << kBatchSamples << " spp in " << elapsed.count()
+                  << " s" << std::endl;
+
+        // Read every layer back at once and write the views out
+        const vk::DeviceSize layerSize =
+            4 * sizeof(float) * WIDTH * HEIGHT;
+        Buffer readbackBuffer{context,
+            Buffer::Type::Readback,
+            layerSize * batchViews};
+        const Ticket copied =
+            context.submit([&](vk::CommandBuffer commandBuffer) {
+                vk::BufferImageCopy region;
+                region.setImageSubresource(
+                    {vk::ImageAspectFlagBits::eColor, 0, 0, batchViews});
+                region.setImageExtent({WIDTH, HEIGHT, 1});
+                commandBuffer.copyImageToBuffer(*viewImage.image,
+                    vk::ImageLayout::eGeneral,
+                    *readbackBuffer.buffer,
+                    region);
+            });
+        context.submitter->wait(copied);
+        const auto* texels = static_cast<const float*>(
+            context.device->mapMemory(*readbackBuffer.memory,
+                0,
+                layerSize * batchViews));
+        std::vector<uint8_t> pixels(4 * WIDTH * HEIGHT);
+        for (uint32_t view = 0; view < batchViews; view++) {
+            const float* layer = texels + pixels.size() * view;
+            for (size_t i = 0; i < pixels.size(); i++) {
+                pixels[i] = i % 4 == 3 ? 255 : toDisplay(layer[i]);
+            }
+            const std::string path =
+                "view_" + std::to_string(view) + ".png";
+            stbi_write_png(path.c_str(),
+                WIDTH,
+                HEIGHT,
+                4,
+                pixels.data(),
+                4 * WIDTH);
+            std::cout << "Wrote " << path << std::endl;
+        }
+        context.device->unmapMemory(*readbackBuffer.memory);
+    }
+
+    // Reads back a frame in flight once the timeline passed it: its
+    // pass timings, ray count and whether it converged
+    auto finishFrame = [&](uint32_t slotIndex) {
+        FrameSlot& slot = frameSlots[slotIndex];
+        slot.pending = false;
+        const FrameReadback& readback = frameReadbacks[slotIndex];
+
+        // Stop tracing once no pixel is left above the error target
+        if (slot.adaptiveLaunch && !converged
+            && slot.epoch == convergenceEpoch
+            && readback.activePixels == 0) {
+            converged = true;
+            std::chrono::duration<double> elapsed =
+                std::chrono::steady_clock::now() - accumulationStart;
+            std::cout << "Converged after " << frame << " frames, "
+                      << elapsed.count() << " s" << std::endl;
+        }
+        if (converged || !slot.traced) {
+            return;
+        }
+
+        // Report trace cost
+        const std::vector<double> passMilliseconds =
+            gpuTimers[slotIndex].readMilliseconds(context);
+        const double frameTraceMilliseconds =
+            passMilliseconds[AdaptivePass] + passMilliseconds[TracePass]
+            + passMilliseconds[RestirPass]
+            + passMilliseconds[ReprojectPass];
+        traceMilliseconds += frameTraceMilliseconds;
+        if (slot.scaling) {
+            resolution.update(frameTraceMilliseconds);
+        }
+        if (slot.tilesTraced > 0) {
+            // Next frame's tiles from this frame's cost per tile. Growth
+            // is held to twofold, so a cheap run of sky cannot overshoot
+            // into a heavy region.
+            const double tileMilliseconds = std::max(
+                passMilliseconds[TracePass] / slot.tilesTraced, 1e-3);
+            const double fit = std::min(
+                kTileBudgetMilliseconds / tileMilliseconds,
+                2.0 * tilesPerFrame);
+            tilesPerFrame =
+                std::clamp(uint32_t(fit), 1u, slot.tileCount);
+        }
+        for (uint32_t i = 0; i < kDenoiseIterations; i++) {
+            denoiseMilliseconds[i] += passMilliseconds[DenoisePass + i];
+        }
+        presentMilliseconds += passMilliseconds[ResolvePass]
+                               + passMilliseconds[PresentPass];
+        tracedRays += readback.rays;
+        if (frame % kStatsInterval == 0) {
+            std::cout << (wavefront ? "wavefront" : "trace") << ": "
+                      << traceMilliseconds / kStatsInterval << " ms/frame";
+            if (dynamicResolution) {
+                std::cout << " at " << renderExtent.width << "x"
+                          << renderExtent.height;
+            }
+            if (wavefront) {
+                std::cout << " (" << traceBackendName(extendBackend) << "/"
+                          << traceBackendName(shadowBackend) << ")";
+            }
+            if (kCountRays) {
+                std::cout << ", "
+                          << tracedRays / (traceMilliseconds * 1e3)
+                          << " Mrays/s";
+            }
+            if (slot.adaptiveLaunch) {
+                std::cout << ", " << readback.activePixels
+                          << " active pixels";
+            }
+            if (slot.tilesTraced > 0) {
+                std::cout << ", " << slot.tilesTraced << "/"
+                          << slot.tileCount
+                          << " tiles";
+            }
+            if (denoise) {
+                std::cout << ", denoise:";
+                for (double& milliseconds : denoiseMilliseconds) {
+                    std::cout << " " << milliseconds / kStatsInterval;
+                    milliseconds = 0.0;
+                }
+                std::cout << " ms";
+            }
+            std::cout << ", present: "
+                      << presentMilliseconds / kStatsInterval << " ms, "
+                      << double(frameBarriers) / kStatsInterval
+                      << " barriers/frame ("
+                      << (graph.fullBarriers ? "full" : "tracked") << ")";
+            std::cout << ", record: "
+                      << recordMilliseconds / kStatsInterval << " ms on "
+                      << (parallelRecording ? jobs.thread_count() : 1)
+                      << " threads";
+            std::cout << ", " << context.descriptors->stats().pool_count
+                      << " descriptor pools";
+            const DeletionQueue& deletions = context.submitter->deletions;
+            std::cout << ", deletions: " << deletions.pendingObjects
+                      << " pending (" << deletions.pendingBytes / 1024
+                      << " KiB), " << deletions.freedObjects << " freed ("
+                      << deletions.freedBytes / 1024 << " KiB)";
+            std::cout << std::endl;
+            traceMilliseconds = 0.0;
+            tracedRays = 0;
+            presentMilliseconds = 0.0;
+            frameBarriers = 0;
+            recordMilliseconds = 0.0;
+        }
+    };
+
+    while (batchViews == 0 && !glfwWindowShouldClose(context.window)) {
+        glfwPollEvents();
+
+        // Wait for the frame that last used this slot, rather than for
+        // the whole queue, so the next frames record while it runs
+        const uint32_t slotIndex =
+            static_cast<uint32_t>(submittedFrames % kFramesInFlight);
+        FrameSlot& slot = frameSlots[slotIndex];
+        context.submitter->wait(slot.ticket);
+        if (slot.pending) {
+            finishFrame(slotIndex);
+        }
+
+        // N toggles next-event estimation and restarts accumulation, so
+        // both estimators can be timed to the same noise level.
+        bool neeKey = glfwGetKey(context.window, GLFW_KEY_N) == GLFW_PRESS;
+        if (neeKey && !neeKeyDown) {
+            pushConstants.flags ^= RaygenFlags::NextEventEstimation;
+            restartAccumulation();
+            std::cout << "NEE: "
+                      << ((pushConstants.flags
+                              & RaygenFlags::NextEventEstimation)
+                                 ? "on"
+                                 : "off")
+                      << std::endl;
+        }
+        neeKeyDown = neeKey;
+
+        // S switches between Sobol/blue-noise and PCG white noise
+        bool samplerKey =
+            glfwGetKey(context.window, GLFW_KEY_S) == GLFW_PRESS;
+        if (samplerKey && !samplerKeyDown) {
+            pushConstants.flags ^= RaygenFlags::LowDiscrepancySampler;
+            restartAccumulation();
+            std::cout << "Sampler: "
+                      << ((pushConstants.flags
+                              & RaygenFlags::LowDiscrepancySampler)
+                                 ? "sobol"
+                                 : "pcg")
+                      << std::endl;
+        }
+        samplerKeyDown = samplerKey;
+
+        // A switches between adaptive and uniform sampling, so both can
+        // be timed to convergence
+        bool adaptiveKey =
+            glfwGetKey(context.window, GLFW_KEY_A) == GLFW_PRESS;
+        if (adaptiveKey && !adaptiveKeyDown) {
+            adaptiveSampling = !adaptiveSampling;
+            restartAccumulation();
+            std::cout << "Adaptive sampling: "
+                      << (adaptiveSampling ? "on" : "off") << std::endl;
+        }
+        adaptiveKeyDown = adaptiveKey;
+
+        // D toggles the denoiser and drops to preview sample counts
+        bool denoiseKey =
+            glfwGetKey(context.window, GLFW_KEY_D) == GLFW_PRESS;
+        if (denoiseKey && !denoiseKeyDown) {
+            denoise = !denoise;
+            pushConstants.samplesPerLaunch =
+                denoise ? kPreviewSamplesPerLaunch : kSamplesPerLaunch;
+            adaptiveConstants.samplesPerLaunch =
+                pushConstants.samplesPerLaunch;
+            std::cout << "Denoiser: " << (denoise ? "on" : "off")
+                      << ", " << pushConstants.samplesPerLaunch
+                      << " spp per launch" << std::endl;
+        }
+        denoiseKeyDown = denoiseKey;
+
+        // R moves direct light at the primary hit to ReSTIR
+        bool restirKey =
+            glfwGetKey(context.window, GLFW_KEY_R) == GLFW_PRESS;
+        if (restirKey && !restirKeyDown) {
+            pushConstants.flags ^= RaygenFlags::Restir;
+            restartAccumulation();
+            std::cout << "ReSTIR: "
+                      << ((pushConstants.flags & RaygenFlags::Restir)
+                                 ? "on"
+                                 : "off")
+                      << std::endl;
+        }
+        restirKeyDown = restirKey;
+
+        // W switches between the megakernel and the wavefront tracer, so
+        // their rays/sec can be compared on the same scene
+        bool wavefrontKey =
+            glfwGetKey(context.window, GLFW_KEY_W) == GLFW_PRESS;
+        if (wavefrontKey && !wavefrontKeyDown) {
+            wavefront = !wavefront;
+            restartAccumulation();
+            std::cout << "Path tracer: "
+                      << (wavefront ? "wavefront" : "megakernel")
+                      << std::endl;
+        }
+        wavefrontKeyDown = wavefrontKey;
+
+        // E and Q move the wavefront extension and shadow passes between
+        // the pipeline and ray queries. Results are identical, so the
+        // accumulation carries on.
+        bool extendBackendKey =
+            glfwGetKey(context.window, GLFW_KEY_E) == GLFW_PRESS;
+        bool shadowBackendKey =
+            glfwGetKey(context.window, GLFW_KEY_Q) == GLFW_PRESS;
+        if (extendBackendKey && !extendBackendKeyDown) {
+            extendBackend = extendBackend == TraceBackend::Pipeline
+                                ? TraceBackend::RayQuery
+                                : TraceBackend::Pipeline;
+        }
+        if (shadowBackendKey && !shadowBackendKeyDown) {
+            shadowBackend = shadowBackend == TraceBackend::Pipeline
+                                ? TraceBackend::RayQuery
+                                : TraceBackend::Pipeline;
+        }
+        if ((extendBackendKey && !extendBackendKeyDown)
+            || (shadowBackendKey && !shadowBackendKeyDown)) {
+            std::cout << "Extension rays: "
+                      << traceBackendName(extendBackend)
+                      << ", shadow rays: "
+                      << traceBackendName(shadowBackend) << std::endl;
+        }
+        extendBackendKeyDown = extendBackendKey;
+        shadowBackendKeyDown = shadowBackendKey;
+
+        // B adds a full barrier before every render graph pass, to see
+        // what the tracked barriers save in the pass timestamps
+        bool barrierKey =
+            glfwGetKey(context.window, GLFW_KEY_B) == GLFW_PRESS;
+        if (barrierKey && !barrierKeyDown) {
+            graph.fullBarriers = !graph.fullBarriers;
+            std::cout << "Barriers: "
+                      << (graph.fullBarriers ? "full" : "tracked")
+                      << std::endl;
+        }
+        barrierKeyDown = barrierKey;
+
+        // V lets the render resolution follow the trace time while the
+        // camera moves
+        bool resolutionKey =
+            glfwGetKey(context.window, GLFW_KEY_V) == GLFW_PRESS;
+        if (resolutionKey && !resolutionKeyDown) {
+            dynamicResolution = !dynamicResolution;
+            std::cout << "Dynamic resolution: "
+                      << (dynamicResolution ? "on" : "off") << std::endl;
+        }
+        resolutionKeyDown = resolutionKey;
+
+        // T traces the image in tiles, as many per frame as fit the
+        // budget, for scenes where one launch would stall the display
+        bool tiledKey =
+            glfwGetKey(context.window, GLFW_KEY_T) == GLFW_PRESS;
+        if (tiledKey && !tiledKeyDown) {
+            tiledTracing = !tiledTracing;
+            restartAccumulation();
+            std::cout << "Tiled tracing: " << (tiledTracing ? "on" : "off")
+                      << std::endl;
+        }
+        tiledKeyDown = tiledKey;
+
+        // P switches between recording the passes on every job system
+        // thread and on this one, to compare the CPU recording time
+        bool recordingKey =
+            glfwGetKey(context.window, GLFW_KEY_P) == GLFW_PRESS;
+        if (recordingKey && !recordingKeyDown) {
+            parallelRecording = !parallelRecording;
+            std::cout << "Recording: "
+                      << (parallelRecording ? "parallel" : "serial")
+                      << std::endl;
+        }
+        recordingKeyDown = recordingKey;
+
+        // Moving keeps the accumulation; reprojection carries it over
+        const auto now = std::chrono::steady_clock::now();
+        const std::chrono::duration<float> frameTime = now - lastFrameTime;
+        lastFrameTime = now;
+        if (camera.update(context.window, frameTime.count())) {
+            convergenceEpoch++;
+            staticFrames = 0;
+            stillFrames = 0;
+            if (converged) {
+                converged = false;
+                accumulationStart = now;
+            }
+        } else {
+            stillFrames++;
+        }
+
+        // The wavefront tracer has no ReSTIR, adaptive or tiled
+        // launches. Tiles leave most pixels untraced each frame, so
+        // their history could not follow the camera: tiled tracing
+        // falls back to full launches while it moves, and picks up at
+        // the same tile once it holds still. Reservoir reuse needs every
+        // pixel traced too.
+        tiledLaunch = tiledTracing && !wavefront && stillFrames > 0;
+        restir = (pushConstants.flags & RaygenFlags::Restir)
+                 && lights.count > 0 && !wavefront && !tiledLaunch;
+
+        // The controller's size only holds while the camera moves; once
+        // it holds still the view refines at full resolution. A new
+        // size keeps the accumulation: the reprojection and the
+        // temporal reservoir reuse resample it from the old extent,
+        // like a camera move. The adaptive warm-up starts over, as the
+        // accumulation it reads is laid out at the old size until then.
+        const bool scaling =
+            dynamicResolution && stillFrames < kAdaptiveWarmupFrames;
+        const vk::Extent2D wantedExtent =
+            scaling ? resolution.extent() : vk::Extent2D{WIDTH, HEIGHT};
+        if (wantedExtent != renderExtent) {
+            renderExtent = wantedExtent;
+            convergenceEpoch++;
+            staticFrames = 0;
+            tileCursor = 0;
+            if (converged) {
+                converged = false;
+                accumulationStart = now;
+            }
+        }
+        const glm::mat4 viewProj = camera.viewProj();
+        cameraUniform.viewProj = viewProj;
+        cameraUniform.prevViewProj = prevViewProj;
+        cameraUniform.invViewProj = glm::inverse(viewProj);
+        cameraUniform.position = glm::vec4(camera.position, 1.0f);
+        cameraUniform.renderSize = {renderExtent.width,
+            renderExtent.height};
+        prevViewProj = viewProj;
+
+        // Reservoir reuse needs every pixel traced, so ReSTIR keeps to
+        // full launches
+        adaptiveLaunch =
+            adaptiveSampling && !restir && !wavefront && !tiledLaunch
+            && staticFrames >= kAdaptiveWarmupFrames;
+        // Set before recording, as the passes may record in parallel
+        pushConstants.frame = frame;
+        if (adaptiveLaunch) {
+            pushConstants.flags |= RaygenFlags::AdaptiveLaunch;
+        } else {
+            pushConstants.flags &= ~RaygenFlags::AdaptiveLaunch;
+        }
+
+        const vk::Extent2D grid = tileGrid(renderExtent);
+        const uint32_t tileCount = grid.width * grid.height;
+        tilesTraced = tiledLaunch ? std::min(tilesPerFrame, tileCount) : 0;
+
+        // Acquire next image
+        imageIndex = context.device
+                         ->acquireNextImageKHR(*swapchain,
+                             UINT64_MAX,
+                             *slot.imageAcquired)
+                         .value;
+
+        // Record commands
+        vk::CommandBuffer commandBuffer = *slot.commandBuffer;
+        commandBuffer.begin(vk::CommandBufferBeginInfo(
+            vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+        GpuTimer& gpuTimer = gpuTimers[slotIndex];
+        gpuTimer.reset(commandBuffer);
+
+        // The camera goes in with the frame, after the previous frame's
+        // reads of it
+        vk::MemoryBarrier cameraBarrier(vk::AccessFlagBits::eUniformRead,
+            vk::AccessFlagBits::eTransferWrite);
+        commandBuffer.pipelineBarrier(frameStages,
+            vk::PipelineStageFlagBits::eTransfer,
+            {},
+            cameraBarrier,
+            nullptr,
+            nullptr);
+        commandBuffer.updateBuffer(*cameraBuffer.buffer,
+            0,
+            sizeof(CameraUniform),
+            &cameraUniform);
+        cameraBarrier = vk::MemoryBarrier(
+            vk::AccessFlagBits::eTransferWrite,
+            vk::AccessFlagBits::eUniformRead);
+        commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+            frameStages,
             {},
-            WIDTH,
-            HEIGHT,
-            1);
-
-        vk::Image srcImage = *outputImage.image;
-        vk::Image dstImage = swapchainImages[imageIndex];
-        Image::setImageLayout(commandBuffer,
-            srcImage,
-            vk::ImageLayout::eGeneral,
-            vk::ImageLayout::eTransferSrcOptimal);
-        Image::setImageLayout(commandBuffer,
-            dstImage,
-            vk::ImageLayout::eUndefined,
-            vk::ImageLayout::eTransferDstOptimal);
-        Image::copyImage(commandBuffer, srcImage, dstImage);
-        Image::setImageLayout(commandBuffer,
-            srcImage,
-            vk::ImageLayout::eTransferSrcOptimal,
-            vk::ImageLayout::eGeneral);
-        Image::setImageLayout(commandBuffer,
-            dstImage,
-            vk::ImageLayout::eTransferDstOptimal,
-            vk::ImageLayout::ePresentSrcKHR);
+            cameraBarrier,
+            nullptr,
+            nullptr);
+
+        graph.setImage(swapchainImage, swapchainImages[imageIndex]);
+        graph.passes[historyNode].enabled = !converged;
+        graph.passes[adaptiveNode].enabled = adaptiveLaunch && !converged;
+        graph.passes[traceNode].enabled = !converged;
+        graph.passes[restirNode].enabled = restir && !converged;
+        graph.passes[reprojectNode].enabled = !converged;
+        for (RenderGraph::PassId node : atrousNodes) {
+            graph.passes[node].enabled = denoise;
+        }
+        const uint64_t barriersBefore =
+            graph.tracker.barrierCount + graph.fullBarrierCount;
+        const auto recordStart = std::chrono::steady_clock::now();
+        if (parallelRecording) {
+            framePools.BeginFrame(slotIndex);
+            graph.execute(commandBuffer, gpuTimer, &jobs, &framePools);
+        } else {
+            graph.execute(commandBuffer, gpuTimer);
+        }
+        const std::chrono::duration<double, std::milli> recordTime =
+            std::chrono::steady_clock::now() - recordStart;
+        recordMilliseconds += recordTime.count();
+        frameBarriers += graph.tracker.barrierCount
+                         + graph.fullBarrierCount - barriersBefore;
+        if (!converged) {
+            historyExtent = renderExtent;
+        }
+
+        // Copy the counters out for when the slot comes round again and
+        // clear the ray counter for the next frame
+        vk::MemoryBarrier counterBarrier(
+            vk::AccessFlagBits::eShaderWrite,
+            vk::AccessFlagBits::eTransferRead
+                | vk::AccessFlagBits::eTransferWrite);
+        commandBuffer.pipelineBarrier(frameStages,
+            vk::PipelineStageFlagBits::eTransfer,
+            {},
+            counterBarrier,
+            nullptr,
+            nullptr);
+        const vk::DeviceSize readbackOffset =
+            sizeof(FrameReadback) * slotIndex;
+        commandBuffer.copyBuffer(*rayCounterBuffer.buffer,
+            *frameReadbackBuffer.buffer,
+            vk::BufferCopy(0,
+                readbackOffset + offsetof(FrameReadback, rays),
+                sizeof(uint32_t)));
+        commandBuffer.copyBuffer(*launchArgsBuffer.buffer,
+            *frameReadbackBuffer.buffer,
+            vk::BufferCopy(offsetof(VkTraceRaysIndirectCommandKHR, width),
+                readbackOffset + offsetof(FrameReadback, activePixels),
+                sizeof(uint32_t)));
+        commandBuffer.fillBuffer(*rayCounterBuffer.buffer,
+            0,
+            sizeof(uint32_t),
+            0);
+        counterBarrier = vk::MemoryBarrier(
+            vk::AccessFlagBits::eTransferWrite,
+            vk::AccessFlagBits::eShaderRead
+                | vk::AccessFlagBits::eShaderWrite
+                | vk::AccessFlagBits::eHostRead);
+        commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+            frameStages | vk::PipelineStageFlagBits::eHost,
+            {},
+            counterBarrier,
+            nullptr,
+            nullptr);
 
         commandBuffer.end();
 
-        // Submit
-        context.queue.submit(
-            vk::SubmitInfo().setCommandBuffers(commandBuffer));
+        // Submit behind any uploads recorded since the last frame
+        const Ticket ticket = context.submitter->submitAfterUploads(
+            commandBuffer,
+            *slot.imageAcquired,
+            *renderedSemaphores[imageIndex]);
 
         // Present image
         vk::PresentInfoKHR presentInfo;
         presentInfo.setSwapchains(*swapchain);
         presentInfo.setImageIndices(imageIndex);
-        presentInfo.setWaitSemaphores(*imageAcquiredSemaphore);
+        presentInfo.setWaitSemaphores(*renderedSemaphores[imageIndex]);
         auto result = context.queue.presentKHR(presentInfo);
         if (result != vk::Result::eSuccess) {
             throw std::runtime_error("failed to present.");
         }
-        context.queue.waitIdle();
-        frame++;
+
+        slot.ticket = ticket;
+        slot.pending = true;
+        slot.traced = !converged;
+        slot.adaptiveLaunch = adaptiveLaunch;
+        slot.scaling = scaling;
+        slot.tilesTraced = tilesTraced;
+        slot.tileCount = tileCount;
+        slot.epoch = convergenceEpoch;
+        submittedFrames++;
+        tileCursor = (tileCursor + tilesTraced) % tileCount;
+        if (!converged) {
+            frame++;
+            staticFrames++;
+        }
     }
 
     context.device->waitIdle();
-    glfwDestroyWindow(context.window);
-    glfwTerminate();
+    if (context.window) {
+        glfwDestroyWindow(context.window);
+        glfwTerminate();
+    }
     return 1;
-}
\ No newline at end of file
+}
+// Command line of the prototype: `--batch <views>` renders that many
+// orbit views headless and writes them out, no arguments open the
+// interactive window
+int run(int argc, char** argv) {
+    uint32_t batchViews = 0;
+    for (int i = 1; i < argc; i++) {
+        const std::string argument = argv[i];
+        if (argument == "--batch" && i + 1 < argc) {
+            batchViews = static_cast<uint32_t>(std::stoul(argv[++i]));
+            if (batchViews > 0) {
+                continue;
+            }
+        }
+        std::cerr << "usage: " << argv[0] << " [--batch <views>]"
+                  << std::endl;
+        return 1;
+    }
+    return run(batchViews);
+}
@@ -1 +1,2 @@
-// int run();
+// int run(uint32_t batchViews = 0);
+// int run(int argc, char** argv);